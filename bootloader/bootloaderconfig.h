@@ -168,6 +168,24 @@ static inline void  bootLoaderInit(void)
 //    MCUCSR = 0;                     /* clear all reset flags for next time */
 }
 
+/* Decide on the boot path without touching USB. The application is started
+ * right away unless one of these asks for the bootloader:
+ *  - the hardware jumper on PD5 is set
+ *  - the watchdog reset the chip, i.e. the application hangs
+ *  - there is no application (reset vector is erased flash)
+ *  - the application wrote UBOOT_SOFTJUMPER to EEPROM before jumping here
+ */
+static inline uchar bootLoaderCondition(void)
+{
+    if(!(PIND & (1 << 5)))
+        return 1;
+    if(MCUCSR & (1 << WDRF))
+        return 1;
+    if(pgm_read_word((void *)0) == 0xffff)
+        return 1;
+    return eeprom_read_byte((void *)UBOOT_SOFTJUMPER_ADDRESS) == UBOOT_SOFTJUMPER;
+}
+
 static inline void  bootLoaderExit(void)
 {
   //  PORTD = (1 << 5);                 // turn yellow led off
@@ -15,6 +15,7 @@
 #include <avr/boot.h>
 #include <avr/eeprom.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 #include <string.h>
 
 static void leaveBootloader() __attribute__((__noreturn__));
@@ -43,6 +44,18 @@ static void leaveBootloader() __attribute__((__noreturn__));
 #define USBASP_FUNC_WRITEEEPROM     8
 #define USBASP_FUNC_SETLONGADDRESS  9
 
+/* uDMX extension, not part of the USBasp protocol:
+ * USBASP_FUNC_GETPAGECRC returns the CRC of up to 4 consecutive flash pages.
+ *  wValue: address of the first page in bytes
+ *  wIndex: number of pages to check
+ * The reply holds one 16 bit CRC per page, low byte first. The CRC is
+ * CRC-CCITT as computed by avr-libc's _crc_ccitt_update() (reflected
+ * polynomial 0x8408, initial value 0xffff). A host flasher compares these
+ * against its image to skip unchanged pages and to verify written ones.
+ * Bootloaders without this extension ignore the request and return no data.
+ */
+#define USBASP_FUNC_GETPAGECRC      0x40
+
 
 
 /* ------------------------------------------------------------------------ */
@@ -142,11 +155,25 @@ static void leaveBootloader()
 
 /* ------------------------------------------------------------------------ */
 
+static uint pageCrc(uint address)
+{
+uint    crc = 0xffff;
+uint    i;
+
+    for(i = 0; i < SPM_PAGESIZE; i++){
+        crc = _crc_ccitt_update(crc, pgm_read_byte((void *)address));
+        address++;
+    }
+    return crc;
+}
+
+/* ------------------------------------------------------------------------ */
+
 uchar   usbFunctionSetup(uchar data[8])
 {
 usbRequest_t    *rq = (void *)data;
 uchar           len = 0;
-static uchar    replyBuffer[4];
+static uchar    replyBuffer[8];
 
     usbMsgPtr = replyBuffer;
     if(rq->bRequest == USBASP_FUNC_TRANSMIT){   /* emulate parts of ISP protocol */
@@ -168,8 +195,19 @@ static uchar    replyBuffer[4];
         }
         replyBuffer[3] = rval;
         len = 4;
+    }else if(rq->bRequest == USBASP_FUNC_GETPAGECRC){
+        uint    address = rq->wValue.word & ~(SPM_PAGESIZE - 1);
+        uchar   pages = rq->wIndex.bytes[0];
+        if(pages > sizeof(replyBuffer) / 2)
+            pages = sizeof(replyBuffer) / 2;
+        while(pages--){
+            uint crc = pageCrc(address);
+            replyBuffer[len++] = crc;
+            replyBuffer[len++] = crc >> 8;
+            address += SPM_PAGESIZE;
+        }
     }else if(rq->bRequest == USBASP_FUNC_ENABLEPROG){
-        /* replyBuffer[0] = 0; is never touched and thus always 0 which means success */
+        replyBuffer[0] = 0;     /* 0 means success; GETPAGECRC may have left data here */
         len = 1;
     }else if(rq->bRequest >= USBASP_FUNC_READFLASH && rq->bRequest <= USBASP_FUNC_SETLONGADDRESS){
         currentAddress.w[0] = rq->wValue.word;
@@ -319,17 +357,12 @@ int main(void)
     GICR = (1 << IVSEL); /* move interrupts to boot flash section */
 #endif
 
-	do_boot_load = ~PIND & (1 << 5);  			// see if jumper is set (= 0)
-	do_boot_load += ~MCUCSR & (1 << PORF);		// if we come here without a power on reset
-												// we were forced into the bootloader, lets bootload even if there's no jumper!
+    do_boot_load = bootLoaderCondition();
+    MCUCSR &= ~(1 << WDRF);                     /* don't come back here on the next external reset */
 
-	do_boot_load += MCUCSR & (1 << WDRF);	// a watchdog timer reset means a serious problem with our code
-											// start bootloader
-	//do_boot_load = 1;
-	
-	
-    if(do_boot_load){							// start bootloader in any of these cases
+    if(do_boot_load){                           /* start bootloader in any of these cases */
         uint i = 0;
+        MCUCSR &= ~(1 << PORF);                 /* the host has seen us now, tell the application to re-enumerate */
 		initForUsbConnectivity();
   
      
@@ -346,6 +379,9 @@ int main(void)
             }
 
         }while(1);  /* main event loop */
+
+        if(eeprom_read_byte((void *)UBOOT_SOFTJUMPER_ADDRESS) == UBOOT_SOFTJUMPER)
+            eeprom_write_byte((void *)UBOOT_SOFTJUMPER_ADDRESS, 0xff);  /* regular boot from now on */
     }
   	leaveBootloader();
     return 0;
@@ -11,157 +11,470 @@
 /*
 General Description:
 This program controls the PowerSwitch USB device from the command line.
-It must be linked with libusb, a library for accessing the USB bus from
-Linux, FreeBSD, Mac OS X and other Unix operating systems. Libusb can be
-obtained from http://libusb.sourceforge.net/.
+It must be linked with libudmx (../libudmx) and libusb, a library for
+accessing the USB bus from Linux, FreeBSD, Mac OS X and other Unix operating
+systems. Libusb can be obtained from http://libusb.sourceforge.net/.
+
+With -stream the devices stay open and values are read from stdin, either
+lines of "<channel> <value> [<value> ...]" or, with -binary, frames of 512
+bytes. A reader thread puts them into the universes, the main thread
+commits the changes at a fixed rate from absolute deadlines, so the frame
+clock doesn't drift with the time it takes to send. The libudmx device
+manager sends them, one worker thread per device, and finds devices again
+that went away. With -universes or a list of serials one process drives
+several devices: lines start with the universe, frames hold one universe
+after the other. -sync has the devices hold their output while the changes
+are uploaded and start them all on the same frame, see the device manager.
+-fifo runs it under SCHED_FIFO if we are allowed to.
+
+-bench measures what a device, cable and hub sustain: it sends one
+workload after the other as fast as they go, one transfer at a time as
+libudmx does, and reports transfers and channels per second and how long
+the transfers took.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <usb.h>    /* this is libusb, see http://libusb.sourceforge.net/ */
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
-#define USBDEV_SHARED_VENDOR    0x16C0  /* VOTI */
-#define USBDEV_SHARED_PRODUCT   0x05E4  /* Obdev's free shared PID */
-/* Use obdev's generic shared VID/PID pair and follow the rules outlined
- * in firmware/usbdrv/USBID-License.txt.
- */
+#include "../libudmx/libudmx.h"
 
-#include "../common/uDMX_cmds.h"
+#define STREAM_RATE         44      /* frames per second, a full universe takes 22.7 ms on the wire */
+#define STREAM_RATE_MAX     1000
+#define MAX_UNIVERSES       64      /* devices driven by one -stream */
+#define BENCH_SECONDS       2       /* per workload */
+#define BENCH_SAMPLES       100000  /* latencies kept per workload */
 
 static void usage(char *name)
 {
     fprintf(stderr, "usage:\n");
-    fprintf(stderr, "  %s <channel> <value> [<value> ...]\n", name);
+    fprintf(stderr, "  %s [-serial <serial>] <channel> <value> [<value> ...]\n", name);
+    fprintf(stderr, "  %s [-serial <serial>] -bootloader\n", name);
+    fprintf(stderr, "  %s [-serial <serial>[,<serial> ...]] -stream [-universes <n>] [-rate <hz>] [-binary] [-sync] [-fifo [<priority>]]\n", name);
+    fprintf(stderr, "      reads \"<channel> <value> [<value> ...]\" lines, or with -binary frames\n");
+    fprintf(stderr, "      of %d bytes, from stdin and sends the changes <hz> times per second.\n", UDMX_CHANNELS);
+    fprintf(stderr, "      with several universes lines start with the universe and a frame\n");
+    fprintf(stderr, "      holds all of them, one device per universe, in serial number order\n");
+    fprintf(stderr, "      unless the serials are given. -sync starts the changes on all of them\n");
+    fprintf(stderr, "      on the same DMX frame\n");
+    fprintf(stderr, "  %s [-serial <serial>] -bench [-seconds <n>] [-frames]\n", name);
+    fprintf(stderr, "      measures transfers per second and latency for a series of workloads\n");
+    fprintf(stderr, "  %s -list\n", name);
 }
 
-
-static int  usbGetStringAscii(usb_dev_handle *dev, int index, int langid, char *buf, int buflen)
+static int listDevices(void)
 {
-char    buffer[256];
-int     rval, i;
-
-    if((rval = usb_control_msg(dev, USB_ENDPOINT_IN, USB_REQ_GET_DESCRIPTOR, (USB_DT_STRING << 8) + index, langid, buffer, sizeof(buffer), 1000)) < 0)
-        return rval;
-    if(buffer[1] != USB_DT_STRING)
-        return 0;
-    if((unsigned char)buffer[0] < rval)
-        rval = (unsigned char)buffer[0];
-    rval /= 2;
-    /* lossy conversion to ISO Latin1 */
-    for(i=1;i<rval;i++){
-        if(i > buflen)  /* destination buffer overflow */
-            break;
-        buf[i-1] = buffer[2 * i];
-        if(buffer[2 * i + 1] != 0)  /* outside of ISO Latin1 range */
-            buf[i-1] = '?';
+char    serials[64][UDMX_SERIAL_LEN];
+int     i, n;
+
+    n = libudmx_enumerate(serials, 64);
+    if(n < 0){
+        fprintf(stderr, "Could not access the USB bus\n");
+        return 1;
     }
-    buf[i-1] = 0;
-    return i-1;
+    for(i = 0; i < n && i < 64; i++)
+        printf("%s\n", serials[i][0] ? serials[i] : "(no serial number)");
+    if(n == 0)
+        fprintf(stderr, "Could not find USB device \"uDMX\"\n");
+    return n == 0;
 }
 
+/* ------------------------------------------------------------------------- */
 
-/* PowerSwitch uses the free shared default VID/PID. If you want to see an
- * example device lookup where an individually reserved PID is used, see our
- * RemoteSensor reference implementation.
- */
-static usb_dev_handle   *findDevice(void)
+typedef struct streamInput {
+    libudmx_manager *m;
+    int             universes;
+    int             binary;
+    volatile int    changed;        /* something was applied since the last commit */
+    volatile int    done;           /* stdin is at its end */
+} streamInput;
+
+static void *readInput(void *arg)
 {
-struct usb_bus      *bus;
-struct usb_device   *dev;
-usb_dev_handle      *handle = 0;
-
-    usb_find_busses();
-    usb_find_devices();
-    for(bus=usb_busses; bus; bus=bus->next){
-        for(dev=bus->devices; dev; dev=dev->next){
-            if(dev->descriptor.idVendor == USBDEV_SHARED_VENDOR && dev->descriptor.idProduct == USBDEV_SHARED_PRODUCT){
-                char    string[256];
-                int     len;
-                handle = usb_open(dev); /* we need to open the device in order to query strings */
-                if(!handle){
-                    fprintf(stderr, "Warning: cannot open USB device: %s\n", usb_strerror());
+streamInput     *in = (streamInput *)arg;
+unsigned char   values[UDMX_CHANNELS];
+char            line[8192], *p, *end;
+libudmx_span    span;
+long            universe = 0, chan, val;
+int             u;
+
+    if(in->binary){
+        for(;;){                                    /* one frame per universe */
+            for(u = 0; u < in->universes; u++){
+                if(fread(values, 1, UDMX_CHANNELS, stdin) != UDMX_CHANNELS)
+                    goto done;
+                if(libudmx_manager_apply_frame(in->m, u, values) > 0)  /* libudmx locks, the worker may be flushing */
+                    in->changed = 1;
+            }
+        }
+    }else{
+        while(fgets(line, sizeof(line), stdin)){
+            p = line;
+            if(in->universes > 1){
+                universe = strtol(line, &p, 0);
+                if(p == line)                       /* empty line or comment */
+                    continue;
+                if(universe < 0 || universe >= in->universes){
+                    fprintf(stderr, "universe must be in the range 0 .. %d\n", in->universes - 1);
                     continue;
                 }
-                /* now find out whether the device actually is obdev's Remote Sensor: */
-                len = usbGetStringAscii(handle, dev->descriptor.iManufacturer, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    fprintf(stderr, "warning: cannot query manufacturer for device: %s\n", usb_strerror());
-                    goto skipDevice;
-                }
-                /* fprintf(stderr, "seen device from vendor ->%s<-\n", string); */
-                if(strcmp(string, "www.anyma.ch") != 0)
-                    goto skipDevice;
-                len = usbGetStringAscii(handle, dev->descriptor.iProduct, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    fprintf(stderr, "warning: cannot query product for device: %s\n", usb_strerror());
-                    goto skipDevice;
-                }
-                /* fprintf(stderr, "seen product ->%s<-\n", string); */
-                if(strcmp(string, "uDMX") == 0)
+            }
+            chan = strtol(p, &end, 0);
+            if(end == p)
+                continue;
+            if(chan < 0 || chan >= UDMX_CHANNELS){
+                fprintf(stderr, "channel must be in the range 0 .. %d\n", UDMX_CHANNELS - 1);
+                continue;
+            }
+            span.start = chan;
+            span.len = 0;
+            span.data = values;
+            for(p = end; span.start + span.len < UDMX_CHANNELS; p = end){
+                val = strtol(p, &end, 0);
+                if(end == p)
                     break;
-skipDevice:
-                usb_close(handle);
-                handle = NULL;
+                values[span.len++] = val < 0 ? 0 : val > 255 ? 255 : val;
             }
+            if(span.len && libudmx_manager_apply(in->m, universe, &span, 1) > 0)  /* one line goes out with one commit */
+                in->changed = 1;
         }
-        if(handle)
+    }
+done:
+    in->done = 1;
+    return NULL;
+}
+
+static void addTime(struct timespec *t, long ns)
+{
+    t->tv_nsec += ns;
+    while(t->tv_nsec >= 1000000000L){
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+static int isLater(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/* sleep until an absolute time on the monotonic clock */
+static void sleepUntil(const struct timespec *deadline)
+{
+#ifdef __APPLE__    /* no clock_nanosleep, sleep for what is left */
+struct timespec now, left;
+
+    for(;;){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(!isLater(deadline, &now))
+            return;
+        left.tv_sec = deadline->tv_sec - now.tv_sec;
+        left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+        if(left.tv_nsec < 0){
+            left.tv_nsec += 1000000000L;
+            left.tv_sec--;
+        }
+        nanosleep(&left, NULL);
+    }
+#else
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+        ;
+#endif
+}
+
+static int stream(char *serials, int argc, char **argv)
+{
+streamInput         in;
+libudmx_device      *dev;
+pthread_t           reader;
+struct timespec     deadline, now;
+struct sched_param  param;
+char                found[MAX_UNIVERSES][UDMX_SERIAL_LEN], *serial[MAX_UNIVERSES], *p;
+long                period, rate = STREAM_RATE, late = 0;
+int                 i, u, n, mapped = 0, sync = 0, fifo = 0, priority = 0, rval = 0;
+
+    memset(&in, 0, sizeof(in));
+    in.universes = 1;
+    for(i = 0; i < argc; i++){
+        if(strcmp(argv[i], "-rate") == 0 && i + 1 < argc){
+            rate = atol(argv[++i]);
+        }else if(strcmp(argv[i], "-universes") == 0 && i + 1 < argc){
+            in.universes = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "-binary") == 0){
+            in.binary = 1;
+        }else if(strcmp(argv[i], "-sync") == 0){
+            sync = 1;
+        }else if(strcmp(argv[i], "-fifo") == 0){
+            fifo = 1;
+            if(i + 1 < argc && argv[i + 1][0] != '-')
+                priority = atoi(argv[++i]);
+        }else{
+            return -1;
+        }
+    }
+    if(rate < 1 || rate > STREAM_RATE_MAX){
+        fprintf(stderr, "rate must be in the range 1 .. %d\n", STREAM_RATE_MAX);
+        return 1;
+    }
+    for(p = serials; p && mapped < MAX_UNIVERSES; ){  /* "a,b,c" maps universes 0, 1 and 2 */
+        serial[mapped++] = p;
+        if((p = strchr(p, ',')) != NULL)
+            *p++ = 0;
+    }
+    if(in.universes < mapped)
+        in.universes = mapped;
+    if(in.universes < 1 || in.universes > MAX_UNIVERSES){
+        fprintf(stderr, "universes must be in the range 1 .. %d\n", MAX_UNIVERSES);
+        return 1;
+    }
+    n = libudmx_enumerate(found, MAX_UNIVERSES);
+    if(n <= 0){
+        fprintf(stderr, "Could not find USB device \"uDMX\"\n");
+        return 1;
+    }
+    if(n < in.universes)
+        fprintf(stderr, "Found %d uDMX for %d universes, the others are sent when they show up\n", n, in.universes);
+    period = 1000000000L / rate;
+
+    if(fifo){   /* the frame clock and the workers run at real time priority, the reader doesn't need to */
+        if(priority <= 0)
+            priority = sched_get_priority_min(SCHED_FIFO) + 10;
+        param.sched_priority = priority;
+        if((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+            fprintf(stderr, "Could not use SCHED_FIFO: %s, going on without\n", strerror(errno));
+    }
+    if((in.m = libudmx_manager_new(in.universes)) == NULL){   /* the workers inherit our policy */
+        fprintf(stderr, "Could not start the device manager\n");
+        return 1;
+    }
+    for(u = 0; u < in.universes; u++){
+        if(u < mapped)
+            libudmx_manager_map(in.m, u, serial[u]);
+        if(in.binary)   /* frames own the whole universe, we don't know what the devices have */
+            libudmx_mark_dirty(libudmx_manager_device(in.m, u), 0, UDMX_CHANNELS);
+    }
+    if(pthread_create(&reader, NULL, readInput, &in) != 0){
+        fprintf(stderr, "Could not start the reader thread\n");
+        libudmx_manager_free(in.m);
+        return 1;
+    }
+    if(fifo){
+        param.sched_priority = 0;
+        pthread_setschedparam(reader, SCHED_OTHER, &param);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while(!in.done){
+        if(!sync){
+            libudmx_manager_commit(in.m);       /* only wakes the workers, they find lost devices again */
+        }else if(in.changed){                   /* all devices switch to the changes on the same DMX frame */
+            in.changed = 0;
+            libudmx_manager_commit_sync(in.m);
+        }
+        addTime(&deadline, period);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(isLater(&now, &deadline)){           /* missed a frame, start over from now instead of catching up */
+            late++;
+            deadline = now;
+        }else{
+            sleepUntil(&deadline);
+        }
+    }
+    pthread_join(reader, NULL);
+    if(sync && in.changed)                      /* the last lines came after the last commit */
+        libudmx_manager_commit_sync(in.m);
+    libudmx_manager_drain(in.m);                /* sending is asynchronous, wait before we exit */
+    for(u = 0; u < in.universes; u++){
+        dev = libudmx_manager_device(in.m, u);
+        if(!libudmx_is_dirty(dev))
+            continue;
+        if(libudmx_is_connected(dev))
+            fprintf(stderr, "Universe %d: USB error: %s\n", u, libudmx_strerror(dev));
+        else
+            fprintf(stderr, "Universe %d: could not find its uDMX\n", u);
+        rval = 1;
+    }
+    libudmx_manager_free(in.m);
+    if(late)
+        fprintf(stderr, "%ld frames were late\n", late);
+    return rval;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static double nowMs(void)
+{
+struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double d = *(const double *)a - *(const double *)b;
+    return d < 0 ? -1 : d > 0;
+}
+
+static double latencies[BENCH_SAMPLES];
+
+/* change len channels from 0 as often as we can for seconds, wait for every transfer */
+static int benchWorkload(libudmx_device *dev, const char *title, int len, int seconds)
+{
+unsigned char   values[UDMX_CHANNELS];
+libudmx_span    span;
+libudmx_stats   before, after;
+double          start, end, sent, updates = 0;
+long            k, i, n = 0;
+int             changed, rval = 0;
+
+    libudmx_get_stats(dev, &before);
+    start = nowMs();
+    end = start + seconds * 1000.;
+    for(k = 0; (sent = nowMs()) < end; k++){
+        for(i = 0; i < len; i++)    /* every channel changes, and not all to the same value */
+            values[i] = k + i;
+        if(len == UDMX_CHANNELS){
+            changed = libudmx_apply_frame(dev, values);
+        }else{
+            span.start = 0;
+            span.len = len;
+            span.data = values;
+            changed = libudmx_apply(dev, &span, 1);
+        }
+        if(changed <= 0)                /* same values as the last workload left, nothing to send */
+            continue;
+        updates += changed;
+        if((rval = libudmx_drain(dev, 1000)) < 0)
             break;
+        if(n < BENCH_SAMPLES)
+            latencies[n++] = nowMs() - sent;
+    }
+    end = nowMs();
+    libudmx_get_stats(dev, &after);
+    if(rval == UDMX_ERR_NOT_OPEN){
+        fprintf(stderr, "%s: lost the device\n", title);
+        return 1;
+    }
+    if(!n){
+        printf("%-12s no transfer completed: %s\n", title, libudmx_strerror(dev));
+        return 1;
     }
-    if(!handle)
-        fprintf(stderr, "Could not find USB device www.anyma.ch/uDMX\n");
-    return handle;
+    qsort(latencies, n, sizeof(double), compareDoubles);
+    printf("%-12s %10.0f %12.0f %8.2f %8.2f %8.2f %8.2f %8.2f %8lu\n", title,
+           (after.transfers - before.transfers) * 1000. / (end - start),
+           updates * 1000. / (end - start),
+           latencies[0], latencies[n / 2], latencies[n * 95 / 100], latencies[n * 99 / 100], latencies[n - 1],
+           after.failures - before.failures);
+    return 0;
+}
+
+static int bench(libudmx_device *dev, int argc, char **argv)
+{
+static const struct { const char *title; int len; } workloads[] = {
+    {"single", 1}, {"range 8", 8}, {"range 64", 64}, {"range 256", 256}, {"universe", UDMX_CHANNELS}
+};
+double  overhead, perByte, period;
+int     i, seconds = BENCH_SECONDS, frames = 0;
+
+    for(i = 0; i < argc; i++){
+        if(strcmp(argv[i], "-seconds") == 0 && i + 1 < argc){
+            seconds = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "-frames") == 0){
+            frames = 1;
+        }else{
+            return -1;
+        }
+    }
+    if(seconds < 1)
+        seconds = 1;
+    libudmx_set_refresh(dev, 0);        /* only our transfers on the bus */
+    libudmx_mark_dirty(dev, 0, UDMX_CHANNELS);
+    libudmx_drain(dev, 1000);
+
+    printf("device %s, %d s per workload\n", libudmx_serial(dev)[0] ? libudmx_serial(dev) : "(no serial number)", seconds);
+    printf("%-12s %10s %12s %8s %8s %8s %8s %8s %8s\n", "workload", "transfers/s", "channels/s",
+           "min ms", "median", "95%", "99%", "max", "failures");
+    for(i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++){
+        if(benchWorkload(dev, workloads[i].title, workloads[i].len, seconds))
+            return 1;
+    }
+    libudmx_cost(dev, &overhead, &perByte);
+    printf("transfer cost: %.0f us + %.1f us per byte\n", overhead, perByte);
+    if(frames){
+        if(libudmx_next_frame(dev, &period) >= 0.)
+            printf("DMX frames: every %.2f ms, %.1f per second\n", period, 1000. / period);
+        else
+            printf("DMX frames: the firmware doesn't report its frame clock\n");
+    }
+    return 0;
 }
 
 int main(int argc, char **argv)
 {
-usb_dev_handle      *handle = NULL;
-unsigned char       buffer[8];
-int                 nBytes;
-	usb_set_debug(1);
-   
-    usb_init();
-    if((handle = findDevice()) == NULL){
-        fprintf(stderr, "Could not find USB device \"uDMX\" with vid=0x%x pid=0x%x\n", USBDEV_SHARED_VENDOR, USBDEV_SHARED_PRODUCT);
+libudmx_device      *dev;
+unsigned char       buffer[UDMX_CHANNELS];
+libudmx_span        span;
+char                *name = argv[0], *serial = NULL;
+int                 i, rval;
+
+    if(argc == 2 && strcmp(argv[1], "-list") == 0)
+        return listDevices();
+    if(argc >= 3 && strcmp(argv[1], "-serial") == 0){   /* talk to this one if there are several */
+        serial = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    if(argc >= 2 && strcmp(argv[1], "-stream") == 0){   /* the device manager opens the devices */
+        rval = stream(serial, argc - 2, argv + 2);
+        if(rval < 0)
+            usage(name);
+        return rval != 0;
+    }
+    dev = libudmx_new(serial);
+    if(!dev || libudmx_connect(dev) != UDMX_OK){
+        fprintf(stderr, "Could not find USB device \"uDMX\"\n");
         exit(1);
     }
+	if(argc >= 2 && strcmp(argv[1], "-bench") == 0){
+		rval = bench(dev, argc - 2, argv + 2);
+		libudmx_free(dev);
+		if(rval < 0)
+			usage(name);
+		return rval != 0;
+	}
 	if(argc < 3){
 		if (argc == 2 && strcmp(argv[1], "-bootloader") == 0) {
-			nBytes = usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
-									cmd_StartBootloader, 0, 0, buffer, sizeof(buffer), 5000);
-			printf("Starting bootloader...\nPlease use the ./uboot utility to update firmware.");						
-
+			libudmx_start_bootloader(dev);
+			printf("Starting bootloader...\nPlease use the ./uboot utility to update firmware.");
 		} else {
-			usb_close(handle);
-			usage(argv[0]);
+			libudmx_free(dev);
+			usage(name);
 	        exit(1);
 	    }
-    }
-	if(argc == 3) {
-        int channel = 0, value = 0;
-        channel = atoi(argv[1]);
-		value = atoi(argv[2]);
-		nBytes = usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-									cmd_SetSingleChannel, value, channel, buffer, sizeof(buffer), 5000);
-        fprintf(stderr, "bytes returned: %i\n", nBytes);
-		if(nBytes < 0)
-            fprintf(stderr, "USB error: %s\n", usb_strerror());
-		else if(nBytes > 0) printf("returned: %i\n", (int)(buffer[0]));
     }
 	else {
-		int channel = atoi(argv[1]), i;
-		unsigned char* buf = malloc(argc - 2);
-		printf("argc: %i\n", argc);
-		for(i=2; i<argc; ++i) buf[i-2] = atoi(argv[i]);
-		nBytes = usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-									cmd_SetChannelRange, argc-2, channel, buf, argc-2, 5000);
-        fprintf(stderr, "bytes returned: %i\n", nBytes);
-		if(nBytes < 0)
-            fprintf(stderr, "USB error: %s\n", usb_strerror());
-		else if(nBytes > 0) printf("returned: %i\n", (int)(buf[0]));
-		free(buf);
+		/* one value is sent as cmd_SetSingleChannel, more as cmd_SetChannelRange */
+		span.start = atoi(argv[1]);
+		if(span.start >= UDMX_CHANNELS){
+			fprintf(stderr, "channel must be in the range 0 .. %d\n", UDMX_CHANNELS - 1);
+			libudmx_free(dev);
+			exit(1);
+		}
+		span.len = argc - 2;
+		span.data = buffer;
+		if(span.len > UDMX_CHANNELS) span.len = UDMX_CHANNELS;
+		for(i=0; i<span.len; ++i) buffer[i] = atoi(argv[i+2]);
+		libudmx_apply(dev, &span, 1);
+		libudmx_mark_dirty(dev, span.start, span.len);   /* send them even if they are 0, only them */
+		rval = libudmx_drain(dev, 1000);    /* sending is asynchronous, wait before we exit */
+		if(rval < 0)
+            fprintf(stderr, "USB error: %s\n", libudmx_strerror(dev));
 	}
-    usb_close(handle);
+    libudmx_free(dev);
     return 0;
 }
-
@@ -0,0 +1,561 @@
+/* Name: uboot.c
+ * Project: uDMX
+ * Author: Max & Michael Egger
+ * Creation Date: 2026-10-19
+ * Tabsize: 4
+ * Copyright: (c) 2026 by [ a n y m a ]
+ * License: GNU GPL v2 (see firmware/usbdrv/License.txt)
+ */
+
+/*
+General Description:
+This program flashes uDMX firmware through the USBasp compatible bootloader
+in bootloader/main.c. It talks to the bootloader directly through libusb and
+flashes every bootloader found on the bus in parallel, one process per device.
+
+The bootloader reports a CRC for each flash page (USBASP_FUNC_GETPAGECRC).
+Pages that already hold the right data are skipped, written pages are
+verified by their CRC instead of reading the flash back.
+
+With -s, the serial number descriptor in the hex image is replaced for every
+device, starting at the given serial and counting up, so a batch of units can
+be provisioned without editing firmware/main.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <usb.h>    /* this is libusb, see http://libusb.sourceforge.net/ */
+
+#include "../common/uDMX_cmds.h"
+
+#define USBDEV_SHARED_VENDOR    0x16C0  /* VOTI */
+#define USBDEV_SHARED_PRODUCT   0x05DC  /* Obdev's free shared PID, used by the bootloader */
+#define USBDEV_UDMX_PRODUCT     0x05E4  /* Obdev's free shared PID for MIDI devices, used by the firmware */
+
+/* Request constants used by USBasp, see bootloader/main.c */
+#define USBASP_FUNC_CONNECT         1
+#define USBASP_FUNC_DISCONNECT      2
+#define USBASP_FUNC_TRANSMIT        3
+#define USBASP_FUNC_READFLASH       4
+#define USBASP_FUNC_WRITEFLASH      6
+#define USBASP_FUNC_GETPAGECRC      0x40
+
+#define USBASP_BLOCKFLAG_LAST       2   /* write partial pages at the end of the block */
+#define GETPAGECRC_MAX_PAGES        4   /* pages per USBASP_FUNC_GETPAGECRC request */
+
+#define MAX_DEVICES     64
+#define MAX_FLASH       (32 * 1024)
+#define MAX_SERIAL      32
+
+typedef struct deviceType{
+    unsigned char   signature[3];
+    const char      *name;
+    int             pageSize;
+    int             bootloaderAddress;  /* application flash ends here */
+}deviceType_t;
+
+static const deviceType_t   deviceTypes[] = {
+    {{0x1e, 0x93, 0x07}, "ATmega8",     64,  0x1800},
+    {{0x1e, 0x93, 0x0a}, "ATmega88",    64,  0x1800},
+    {{0x1e, 0x94, 0x06}, "ATmega168",   128, 0x3800},
+    {{0x1e, 0x95, 0x0f}, "ATmega328P",  128, 0x7800},
+};
+
+static unsigned char    image[MAX_FLASH];
+static int              imageEnd;
+static int              forceFlash;
+
+static void usage(char *name)
+{
+    fprintf(stderr, "usage:\n");
+    fprintf(stderr, "  %s [-b] [-f] [-j <jobs>] [-s <serial>] <firmware.hex>\n", name);
+    fprintf(stderr, "    -b           restart all running uDMX devices into the bootloader first\n");
+    fprintf(stderr, "    -f           also flash bootloaders without page CRC support\n");
+    fprintf(stderr, "                 (careful: this includes real USBasp programmers)\n");
+    fprintf(stderr, "    -j <jobs>    flash at most <jobs> devices at the same time\n");
+    fprintf(stderr, "    -s <serial>  serial number for the first device, counted up for the others\n");
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Same as _crc_ccitt_update() in avr-libc, which the bootloader uses. */
+static unsigned short   crcCcittUpdate(unsigned short crc, unsigned char data)
+{
+    data ^= crc & 0xff;
+    data ^= data << 4;
+    return (((unsigned short)data << 8) | (crc >> 8)) ^ (unsigned char)(data >> 4) ^ ((unsigned short)data << 3);
+}
+
+static unsigned short   pageCrc(const unsigned char *page, int pageSize)
+{
+unsigned short  crc = 0xffff;
+int             i;
+
+    for(i = 0; i < pageSize; i++)
+        crc = crcCcittUpdate(crc, page[i]);
+    return crc;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  hexValue(const char *s, int digits)
+{
+int     value = 0;
+
+    while(digits--){
+        if(!isxdigit((unsigned char)*s))
+            return -1;
+        value = (value << 4) | (isdigit((unsigned char)*s) ? *s - '0' : (toupper((unsigned char)*s) - 'A' + 10));
+        s++;
+    }
+    return value;
+}
+
+/* Reads an Intel hex file into image[], returns 0 on success. */
+static int  readHexFile(const char *fileName)
+{
+FILE    *fp;
+char    line[600];
+int     lineNo = 0, base = 0;
+
+    if((fp = fopen(fileName, "r")) == NULL){
+        fprintf(stderr, "Cannot open %s\n", fileName);
+        return -1;
+    }
+    memset(image, 0xff, sizeof(image));
+    imageEnd = 0;
+    while(fgets(line, sizeof(line), fp) != NULL){
+        int len, address, type, sum, i;
+        lineNo++;
+        if(line[0] != ':')
+            continue;
+        len = hexValue(line + 1, 2);
+        address = hexValue(line + 3, 4);
+        type = hexValue(line + 7, 2);
+        if(len < 0 || address < 0 || type < 0 || (int)strlen(line) < 11 + 2 * len)
+            goto badLine;
+        sum = len + (address >> 8) + address + type;
+        for(i = 0; i <= len; i++){
+            int byte = hexValue(line + 9 + 2 * i, 2);
+            if(byte < 0)
+                goto badLine;
+            sum += byte;
+        }
+        if((sum & 0xff) != 0){
+            fprintf(stderr, "%s:%d: checksum error\n", fileName, lineNo);
+            fclose(fp);
+            return -1;
+        }
+        if(type == 0){          /* data */
+            address += base;
+            if(address + len > MAX_FLASH){
+                fprintf(stderr, "%s:%d: address 0x%x out of range\n", fileName, lineNo, address);
+                fclose(fp);
+                return -1;
+            }
+            for(i = 0; i < len; i++)
+                image[address + i] = hexValue(line + 9 + 2 * i, 2);
+            if(address + len > imageEnd)
+                imageEnd = address + len;
+        }else if(type == 1){    /* end of file */
+            break;
+        }else if(type == 2){    /* extended segment address */
+            base = hexValue(line + 9, 4) << 4;
+        }else if(type == 4){    /* extended linear address */
+            base = hexValue(line + 9, 4) << 16;
+        }
+        continue;
+badLine:
+        fprintf(stderr, "%s:%d: syntax error\n", fileName, lineNo);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Serial numbers are formatted as YearMonthDayNCounter, e.g. "110428N0071".
+ * Returns non-zero if s matches this pattern.
+ */
+static int  isSerialNumber(const char *s, int len)
+{
+int     i, sawN = 0;
+
+    for(i = 0; i < len; i++){
+        if(s[i] == 'N' && i > 0 && !sawN && i < len - 1)
+            sawN = 1;
+        else if(!isdigit((unsigned char)s[i]))
+            return 0;
+    }
+    return sawN;
+}
+
+/* Finds the serial number string descriptor (usbDescriptorStringSerialNumber
+ * in firmware/main.c) in image[]. Returns its offset or -1; the number of
+ * characters is stored in *serialLen.
+ */
+static int  findSerialDescriptor(int *serialLen)
+{
+int     i, found = -1;
+
+    for(i = 0; i + 1 < imageEnd; i++){
+        int n = (image[i] - 2) / 2, k;
+        char s[MAX_SERIAL];
+        if(image[i + 1] != 3 || (image[i] & 1) || n < 3 || n >= MAX_SERIAL || i + image[i] > imageEnd)
+            continue;
+        for(k = 0; k < n; k++){
+            if(image[i + 3 + 2 * k] != 0)
+                break;
+            s[k] = image[i + 2 + 2 * k];
+        }
+        if(k < n || !isSerialNumber(s, n))
+            continue;
+        if(found >= 0){
+            fprintf(stderr, "Found more than one serial number descriptor in image\n");
+            return -1;
+        }
+        found = i;
+        *serialLen = n;
+    }
+    return found;
+}
+
+static void patchSerialNumber(int offset, const char *serial)
+{
+int     i;
+
+    for(i = 0; serial[i]; i++){
+        image[offset + 2 + 2 * i] = serial[i];
+        image[offset + 3 + 2 * i] = 0;
+    }
+}
+
+/* Counts up the digits after the 'N', returns -1 on overflow. */
+static int  nextSerialNumber(char *serial)
+{
+int     i = strlen(serial) - 1;
+
+    for(; i >= 0 && serial[i] != 'N'; i--){
+        if(serial[i] < '9'){
+            serial[i]++;
+            return 0;
+        }
+        serial[i] = '0';
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  usbGetStringAscii(usb_dev_handle *dev, int index, int langid, char *buf, int buflen)
+{
+char    buffer[256];
+int     rval, i;
+
+    if((rval = usb_control_msg(dev, USB_ENDPOINT_IN, USB_REQ_GET_DESCRIPTOR, (USB_DT_STRING << 8) + index, langid, buffer, sizeof(buffer), 1000)) < 0)
+        return rval;
+    if(buffer[1] != USB_DT_STRING)
+        return 0;
+    if((unsigned char)buffer[0] < rval)
+        rval = (unsigned char)buffer[0];
+    rval /= 2;
+    /* lossy conversion to ISO Latin1 */
+    for(i=1;i<rval;i++){
+        if(i > buflen)  /* destination buffer overflow */
+            break;
+        buf[i-1] = buffer[2 * i];
+        if(buffer[2 * i + 1] != 0)  /* outside of ISO Latin1 range */
+            buf[i-1] = '?';
+    }
+    buf[i-1] = 0;
+    return i-1;
+}
+
+static int  isDevice(usb_dev_handle *handle, struct usb_device *dev, const char *vendor, const char *product)
+{
+char    string[256];
+
+    if(usbGetStringAscii(handle, dev->descriptor.iManufacturer, 0x0409, string, sizeof(string)) < 0 || strcmp(string, vendor) != 0)
+        return 0;
+    if(usbGetStringAscii(handle, dev->descriptor.iProduct, 0x0409, string, sizeof(string)) < 0 || strcmp(string, product) != 0)
+        return 0;
+    return 1;
+}
+
+/* Asks every running uDMX to start its bootloader, returns the number of devices. */
+static int  startBootloaders(void)
+{
+struct usb_bus      *bus;
+struct usb_device   *dev;
+unsigned char       buffer[8];
+int                 count = 0;
+
+    usb_find_busses();
+    usb_find_devices();
+    for(bus=usb_busses; bus; bus=bus->next){
+        for(dev=bus->devices; dev; dev=dev->next){
+            usb_dev_handle *handle;
+            if(dev->descriptor.idVendor != USBDEV_SHARED_VENDOR || dev->descriptor.idProduct != USBDEV_UDMX_PRODUCT)
+                continue;
+            if((handle = usb_open(dev)) == NULL)
+                continue;
+            if(isDevice(handle, dev, "www.anyma.ch", "uDMX")){
+                /* the device disconnects right away, errors are expected */
+                usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                                cmd_StartBootloader, 0, 0, (char *)buffer, sizeof(buffer), 1000);
+                count++;
+            }
+            usb_close(handle);
+        }
+    }
+    return count;
+}
+
+static int  findBootloaders(struct usb_device **devices, int maxDevices)
+{
+struct usb_bus      *bus;
+struct usb_device   *dev;
+int                 count = 0;
+
+    usb_find_busses();
+    usb_find_devices();
+    for(bus=usb_busses; bus; bus=bus->next){
+        for(dev=bus->devices; dev; dev=dev->next){
+            usb_dev_handle *handle;
+            if(dev->descriptor.idVendor != USBDEV_SHARED_VENDOR || dev->descriptor.idProduct != USBDEV_SHARED_PRODUCT)
+                continue;
+            if((handle = usb_open(dev)) == NULL){
+                fprintf(stderr, "Warning: cannot open USB device: %s\n", usb_strerror());
+                continue;
+            }
+            if(isDevice(handle, dev, "www.fischl.de", "USBasp") && count < maxDevices)
+                devices[count++] = dev;
+            usb_close(handle);
+        }
+    }
+    return count;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static const deviceType_t   *readDeviceType(usb_dev_handle *handle)
+{
+unsigned char   signature[3], buffer[4];
+int             i;
+
+    for(i = 0; i < 3; i++){
+        if(usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                           USBASP_FUNC_TRANSMIT, 0x30, i, (char *)buffer, sizeof(buffer), 5000) != sizeof(buffer))
+            return NULL;
+        signature[i] = buffer[3];
+    }
+    for(i = 0; i < sizeof(deviceTypes) / sizeof(deviceTypes[0]); i++){
+        if(memcmp(signature, deviceTypes[i].signature, 3) == 0)
+            return &deviceTypes[i];
+    }
+    return NULL;
+}
+
+/* Reads the CRCs of all application pages. Returns 0 on success, -1 if the
+ * bootloader does not support USBASP_FUNC_GETPAGECRC.
+ */
+static int  readPageCrcs(usb_dev_handle *handle, const deviceType_t *type, unsigned short *crcs)
+{
+int     pages = type->bootloaderAddress / type->pageSize;
+int     page, i;
+
+    for(page = 0; page < pages; page += GETPAGECRC_MAX_PAGES){
+        unsigned char buffer[2 * GETPAGECRC_MAX_PAGES];
+        int n = pages - page < GETPAGECRC_MAX_PAGES ? pages - page : GETPAGECRC_MAX_PAGES;
+        if(usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                           USBASP_FUNC_GETPAGECRC, page * type->pageSize, n, (char *)buffer, 2 * n, 5000) != 2 * n)
+            return -1;
+        for(i = 0; i < n; i++)
+            crcs[page + i] = buffer[2 * i] | (buffer[2 * i + 1] << 8);
+    }
+    return 0;
+}
+
+static int  writePage(usb_dev_handle *handle, const deviceType_t *type, int page, const unsigned char *data)
+{
+    return usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
+                           USBASP_FUNC_WRITEFLASH, page * type->pageSize, (USBASP_BLOCKFLAG_LAST << 8) | (type->pageSize & 0xff),
+                           (char *)data, type->pageSize, 5000) == type->pageSize ? 0 : -1;
+}
+
+static int  verifyPage(usb_dev_handle *handle, const deviceType_t *type, int page, int haveCrc)
+{
+unsigned char   buffer[256];
+
+    if(haveCrc){
+        if(usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                           USBASP_FUNC_GETPAGECRC, page * type->pageSize, 1, (char *)buffer, 2, 5000) != 2)
+            return -1;
+        return (buffer[0] | (buffer[1] << 8)) == pageCrc(image + page * type->pageSize, type->pageSize) ? 0 : -1;
+    }
+    if(usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                       USBASP_FUNC_READFLASH, page * type->pageSize, 0, (char *)buffer, type->pageSize, 5000) != type->pageSize)
+        return -1;
+    return memcmp(buffer, image + page * type->pageSize, type->pageSize) == 0 ? 0 : -1;
+}
+
+/* Runs in a child process for each device, returns the exit status. */
+static int  flashDevice(struct usb_device *dev, const char *name)
+{
+usb_dev_handle      *handle;
+const deviceType_t  *type;
+unsigned short      crcs[MAX_FLASH / 64];
+unsigned char       changed[MAX_FLASH / 64];
+unsigned char       blank[256];
+int                 pages, page, nChanged = 0, haveCrc, rval = 1;
+
+    if((handle = usb_open(dev)) == NULL){
+        fprintf(stderr, "%s: cannot open USB device: %s\n", name, usb_strerror());
+        return 1;
+    }
+    usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                    USBASP_FUNC_CONNECT, 0, 0, (char *)blank, sizeof(blank), 5000);
+    if((type = readDeviceType(handle)) == NULL){
+        fprintf(stderr, "%s: unknown device signature\n", name);
+        goto done;
+    }
+    if(imageEnd > type->bootloaderAddress){
+        fprintf(stderr, "%s: image does not fit into %s application flash\n", name, type->name);
+        goto done;
+    }
+    pages = type->bootloaderAddress / type->pageSize;
+    haveCrc = readPageCrcs(handle, type, crcs) == 0;
+    if(!haveCrc && !forceFlash){
+        fprintf(stderr, "%s: no page CRC support, not a uDMX bootloader? Use -f to flash anyway\n", name);
+        goto done;
+    }
+    for(page = 0; page < pages; page++){
+        changed[page] = !haveCrc || crcs[page] != pageCrc(image + page * type->pageSize, type->pageSize);
+        nChanged += changed[page];
+    }
+    if(nChanged){
+        /* The bootloader only starts an application with a programmed reset
+         * vector. Erase page 0 first and write it last, so an interrupted
+         * update stays in the bootloader instead of running half a firmware.
+         */
+        memset(blank, 0xff, sizeof(blank));
+        if(writePage(handle, type, 0, blank) != 0)
+            goto writeError;
+        changed[0] = 1;
+        for(page = pages - 1; page >= 0; page--){
+            if(changed[page] && writePage(handle, type, page, image + page * type->pageSize) != 0)
+                goto writeError;
+        }
+        for(page = 0; page < pages; page++){
+            if(changed[page] && verifyPage(handle, type, page, haveCrc) != 0){
+                fprintf(stderr, "%s: verify error at address 0x%04x\n", name, page * type->pageSize);
+                goto done;
+            }
+        }
+    }
+    printf("%s: %s, %d of %d pages written\n", name, type->name, nChanged, pages);
+    usb_control_msg(handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN,
+                    USBASP_FUNC_DISCONNECT, 0, 0, (char *)blank, sizeof(blank), 5000);
+    rval = 0;
+    goto done;
+writeError:
+    fprintf(stderr, "%s: USB error while writing: %s\n", name, usb_strerror());
+done:
+    usb_close(handle);
+    return rval;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+struct usb_device   *devices[MAX_DEVICES];
+char                serial[MAX_SERIAL] = "";
+int                 serialOffset = -1, serialLen = 0;
+int                 jobs = MAX_DEVICES, restart = 0;
+int                 nDevices, i, running = 0, started = 0, failed = 0, opt;
+
+    while((opt = getopt(argc, argv, "bfj:s:")) != -1){
+        switch(opt){
+            case 'b': restart = 1; break;
+            case 'f': forceFlash = 1; break;
+            case 'j': jobs = atoi(optarg); break;
+            case 's': strncpy(serial, optarg, sizeof(serial) - 1); break;
+            default: usage(argv[0]); exit(1);
+        }
+    }
+    if(optind != argc - 1 || jobs < 1){
+        usage(argv[0]);
+        exit(1);
+    }
+    if(readHexFile(argv[optind]) != 0)
+        exit(1);
+    if(serial[0]){
+        if((serialOffset = findSerialDescriptor(&serialLen)) < 0){
+            fprintf(stderr, "Cannot find serial number descriptor in %s\n", argv[optind]);
+            exit(1);
+        }
+        if(strlen(serial) != serialLen || !isSerialNumber(serial, serialLen)){
+            fprintf(stderr, "Serial number must look like YearMonthDayNCounter with %d characters\n", serialLen);
+            exit(1);
+        }
+    }
+
+    usb_init();
+    if(restart){
+        int expected = startBootloaders();
+        /* wait for the bootloaders to enumerate */
+        for(i = 0; i < 50 && findBootloaders(devices, MAX_DEVICES) < expected; i++)
+            usleep(100000);
+    }
+    if((nDevices = findBootloaders(devices, MAX_DEVICES)) == 0){
+        fprintf(stderr, "Could not find a uDMX bootloader with vid=0x%x pid=0x%x\n", USBDEV_SHARED_VENDOR, USBDEV_SHARED_PRODUCT);
+        exit(1);
+    }
+
+    fflush(stdout);
+    for(i = 0; i < nDevices; i++){
+        char    name[96];
+        pid_t   pid;
+        int     status;
+        if(running >= jobs){
+            wait(&status);
+            failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            running--;
+        }
+        snprintf(name, sizeof(name), "%.24s/%.24s", devices[i]->bus->dirname, devices[i]->filename);
+        if(serial[0]){
+            patchSerialNumber(serialOffset, serial);
+            snprintf(name, sizeof(name), "%.24s/%.24s [%s]", devices[i]->bus->dirname, devices[i]->filename, serial);
+        }
+        if((pid = fork()) < 0){
+            perror("fork");
+            failed++;
+            break;
+        }
+        if(pid == 0)
+            exit(flashDevice(devices[i], name));
+        running++;
+        started++;
+        if(serial[0] && nextSerialNumber(serial) != 0){
+            fprintf(stderr, "Serial number counter overflow\n");
+            break;
+        }
+    }
+    while(running > 0){
+        int status;
+        if(wait(&status) < 0)
+            break;
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        running--;
+    }
+    printf("%d of %d devices flashed successfully\n", started - failed, nDevices);
+    return failed ? 1 : 0;
+}
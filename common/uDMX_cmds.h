@@ -26,6 +26,62 @@
 	wLength:		length of data, must be >= wValue
 */
 
+#define cmd_SetChannelSparse 3
+/* usb request for cmd_SetChannelSparse:
+	bmRequestType:	ignored by device, should be USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT
+	bRequest:		cmd_SetChannelSparse
+	wValue:			number of channels to set [1 .. 512]
+	wIndex:			ignored
+	wLength:		length of data, must be >= 3 * wValue
+	data:			wValue times channel index [0 .. 511] (LSB first) and channel value [0 .. 255]
+*/
+#define cmd_FillChannelRange 4
+/* usb request for cmd_FillChannelRange:
+	bmRequestType:	ignored by device, should be USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT
+	bRequest:		cmd_FillChannelRange
+	wValue:			number of channels to set [1 .. 512-wIndex]
+	wIndex:			index of first channel to set [0 .. 511]
+	wLength:		1
+	data:			value for all channels in the range [0 .. 255]
+*/
+
+#define cmd_HoldOutput 5
+/* usb request for cmd_HoldOutput:
+	bmRequestType:	ignored by device, should be USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT
+	bRequest:		cmd_HoldOutput
+	wValue:			1: end the current dmx packet and don't start new ones, the line stays in MARK
+					0: commit, start the next packet right away with the current values
+	wIndex:			ignored
+	wLength:		ignored
+	the device lets go by itself if no commit follows within a few hundred ms
+*/
+
+#define cmd_GetCapabilities 0x10
+/* usb request for cmd_GetCapabilities:
+	bmRequestType:	ignored by device, should be USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN
+	bRequest:		cmd_GetCapabilities
+	wValue:			ignored
+	wIndex:			ignored
+	wLength:		>= 3
+	reply:			capability flags (cap_*), firmware version major, minor
+					firmware before version 1.6 does not know this request and replies with 0 bytes
+*/
+#define cmd_GetFrameStatus 0x11
+/* usb request for cmd_GetFrameStatus:
+	bmRequestType:	ignored by device, should be USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_IN
+	bRequest:		cmd_GetFrameStatus
+	wValue:			ignored
+	wIndex:			ignored
+	wLength:		>= 7
+	reply:			dmx frames started (LSB first, wraps around), index of the next channel to send (LSB first),
+					channels per frame (LSB first), dmx state (0 off, 1 start code, 2 channels, 3 end of frame,
+					4 break, 5 mark after break)
+*/
+#define cap_SetChannelSparse	0x01
+#define cap_FillChannelRange	0x02
+#define cap_FrameStatus			0x04
+#define cap_HoldOutput			0x08
+
 #define cmd_StartBootloader 0xf8
 // Start Bootloader for Software updates
 
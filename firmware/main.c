@@ -10,6 +10,13 @@
 // target-cpu: ATMega8 @ 12MHz
 // created 2006-02-09 mexx
 //
+// version 1.7	   2026-10-19
+//		- frame status request for host scheduling
+//		- hold output while the host uploads, for synchronized commits
+// version 1.6	   2026-10-19
+//		- sparse and fill requests, capability query
+// version 1.5	   2026-10-19
+//		- no fake USB disconnect after power on, soft jumper for bootloader
 // version 1.4	   2009-06-09 me@anyma.ch
 //		- changed usb init routine
 // version 1.3:    2008-11-04 me@anyma.ch
@@ -54,6 +61,8 @@ typedef struct _midi_msg {
 // ------------------------------------------------------------------------------
 
 // device serial number, formatted as YearMonthDayNCounter
+// commandline/uboot finds this descriptor in main.hex and patches it at flash time,
+// keep its length in sync with USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER
 PROGMEM int usbDescriptorStringSerialNumber[] = {USB_STRING_DESCRIPTOR_HEADER(11),'1','1','0','4','2','8','N','0','0','7','1'};
 
 
@@ -65,10 +74,15 @@ static u08 dmx_data[NUM_CHANNELS];
 static u16 out_idx;			// index of next frame to send
 static u16 packet_len = 0;	// we only send frames up to the highest channel set
 static u08 dmx_state;
+static u16 frame_count;		// dmx packets started, wraps around
+static u08 hold;			// don't start new packets, see cmd_HoldOutput
+static u16 hold_count;		// main loop passes while holding, we let go when it wraps
 
 // usb-related globals
 static u08 usb_state;
 static u16 cur_channel, end_channel;
+static u16 sparse_count;	// records left in a cmd_SetChannelSparse transfer
+static u08 sparse_pos;		// byte position within the current record
 static u08 reply[8];
 
 //led keep alive counter
@@ -92,7 +106,7 @@ static PROGMEM char deviceDescrMIDI[] = {	/* USB device descriptor */
 	USB_CFG_DEVICE_VERSION,	/* 2 bytes */
 	1,			/* manufacturer string index */
 	2,			/* product string index */
-	0,			/* serial number string index */
+	3,			/* serial number string index */
 	1,			/* number of configurations */
 };
 
@@ -323,15 +337,19 @@ static void eepromWrite(unsigned char addr, unsigned char val)
 // - Enumerate device
 // ------------------------------------------------------------------------------
 
-static void initForUsbConnectivity(void)
+static void initForUsbConnectivity(u08 power_on)
 {
 uchar   i = 0;
 
-    /* enforce USB re-enumerate: */
-    usbDeviceDisconnect();  /* do this while interrupts are disabled */
-    while(--i){         /* fake USB disconnect for > 250 ms */
-        wdt_reset();
-        _delay_ms(1);
+    // after a power on reset the host has never seen us (the bootloader
+    // clears PORF when it enumerates), so there is nothing to re-enumerate
+    if(!power_on) {
+        /* enforce USB re-enumerate: */
+        usbDeviceDisconnect();  /* do this while interrupts are disabled */
+        while(--i){         /* fake USB disconnect for > 250 ms */
+            wdt_reset();
+            _delay_ms(1);
+        }
     }
     usbDeviceConnect();
     usbInit();
@@ -342,6 +360,8 @@ uchar   i = 0;
 // ------------------------------------------------------------------------------
 void init(void)
 {
+	u08 power_on = MCUCSR & BV(PORF);
+
 	dmx_state = dmx_Off;
 	lka_count = 0xffff;
 	
@@ -387,7 +407,7 @@ void init(void)
 
 	// init usb
     PORTB = 0;				// no pullups on USB pins
-	initForUsbConnectivity();	// enumerate device
+	initForUsbConnectivity(power_on);	// enumerate device
 	
 	sei();
 }
@@ -402,8 +422,9 @@ void startBootloader(void) {
 		
 		
 		MCUCSR &= ~(1 << PORF);			// clear power on reset flag
-										// this will hint the bootloader that it was forced
-	
+		eepromWrite(UBOOT_SOFTJUMPER_ADDRESS, UBOOT_SOFTJUMPER);
+										// the soft jumper tells the bootloader that it was forced,
+										// it is cleared again when the bootloader exits
 		cli();							// turn off interrupts
 		wdt_disable();					// disable watchdog timer
 		usbDeviceDisconnect(); 			// disconnect udmx from USB bus
@@ -459,6 +480,50 @@ uchar usbFunctionSetup(uchar data[8])
 		usb_state = usb_ChannelRange;
 		return 0xFF;
 		
+	} else if(data[1] == cmd_SetChannelSparse) {
+		lka_count = 0;
+		// get number of records, 3 bytes each
+		sparse_count = data[2] | (data[3] << 8);
+		sparse_pos = 0;
+		if((sparse_count > NUM_CHANNELS) || (sparse_count * 3 > (data[6] | (data[7] << 8))))
+			{ reply[0] = err_BadValue; sparse_count = 0; return 1; }
+		usb_state = usb_ChannelSparse;
+		return 0xFF;
+		
+	} else if(data[1] == cmd_FillChannelRange) {
+		lka_count = 0;
+		// get start and end channel index, the value follows as data
+		cur_channel = data[4] | (data[5] << 8);
+		end_channel = cur_channel + (data[2] | (data[3] << 8));
+		if((cur_channel > 511) || (end_channel > 512)) 
+			{ reply[0] = err_BadChannel; cur_channel = end_channel = 0; return 1; }
+		usb_state = usb_ChannelFill;
+		return 0xFF;
+		
+	} else if(data[1] == cmd_GetCapabilities) {
+	
+		reply[0] = cap_SetChannelSparse | cap_FillChannelRange | cap_FrameStatus | cap_HoldOutput;
+		reply[1] = 1;		// firmware version
+		reply[2] = 7;
+		return 3;
+		
+	} else if(data[1] == cmd_HoldOutput) {
+	
+		hold = data[2];		// 0: start the next packet with what we have now
+		hold_count = 0;
+		return 0;
+		
+	} else if(data[1] == cmd_GetFrameStatus) {
+	
+		reply[0] = frame_count & 0xff;
+		reply[1] = frame_count >> 8;
+		reply[2] = out_idx & 0xff;
+		reply[3] = out_idx >> 8;
+		reply[4] = packet_len & 0xff;
+		reply[5] = packet_len >> 8;
+		reply[6] = dmx_state;
+		return 7;
+		
 	} else if(data[1] == cmd_StartBootloader) {
 	
 		startBootloader();
@@ -532,10 +597,43 @@ void usbFunctionWriteOut(uchar * data, uchar len)
 // ------------------------------------------------------------------------------
 uchar usbFunctionWrite(uchar* data, uchar len)
 {
+	uchar* data_end = data + len;
+
+	if(usb_state == usb_ChannelSparse) {
+		lka_count = 0;
+		// records may span packets: channel LSB, channel MSB, value
+		for(; (data < data_end) && sparse_count; ++data) {
+			if(sparse_pos == 0) { cur_channel = *data; sparse_pos = 1; }
+			else if(sparse_pos == 1) { cur_channel |= *data << 8; sparse_pos = 2; }
+			else {
+				if(cur_channel < NUM_CHANNELS) {
+					dmx_data[cur_channel] = *data;
+					if(cur_channel >= packet_len) packet_len = cur_channel+1;
+				}
+				sparse_pos = 0;
+				sparse_count--;
+			}
+		}
+		if(dmx_state == dmx_Off) dmx_state = dmx_NewPacket;
+		if(!sparse_count) {
+			usb_state = usb_Idle;
+			return 1;
+		}
+		return 0;
+	}
+	if(usb_state == usb_ChannelFill) {
+		lka_count = 0;
+		if(!len) return 0;
+		for(; cur_channel < end_channel; ++cur_channel)
+			dmx_data[cur_channel] = *data;
+		if(cur_channel > packet_len) packet_len = cur_channel;
+		if(dmx_state == dmx_Off) dmx_state = dmx_NewPacket;
+		usb_state = usb_Idle;
+		return 1;
+	}
 	if(usb_state != usb_ChannelRange) { return 0xFF; } // stall if not in good state
 	lka_count = 0;
 	// update channel values from received data
-	uchar* data_end = data + len;
 	for(; (data < data_end) && (cur_channel < end_channel); ++data, ++cur_channel)
 		dmx_data[cur_channel] = *data;
 	// update state
@@ -585,9 +683,16 @@ int main(void)
 		// do dmx transmission
 		switch(dmx_state) {
 			case dmx_NewPacket: {
+				// the host is uploading, keep the line in MARK until it commits
+				// or until it has forgotten about us (a few hundred ms)
+				if (hold) {
+					if (++hold_count) break;
+					hold = 0;
+				}
 				// start a new dmx packet:
 				sbi(UCSRB, TXEN);	// enable UART transmitter
 				out_idx = 0;		// reset output channel index
+				frame_count++;
 				sbi(UCSRA, TXC);	// reset Transmit Complete flag
 				UDR =  0;		// send start byte
 				dmx_state = dmx_InPacket;
@@ -596,7 +701,8 @@ int main(void)
 			case dmx_InPacket: {
 				if(UCSRA & BV(UDRE)) {
 					// send next byte of dmx packet
-					if(out_idx < packet_len) { UDR =  dmx_data[out_idx++]; break; }
+					// a hold ends the packet early, so it never shows half of an upload
+					if(out_idx < packet_len && !hold) { UDR =  dmx_data[out_idx++]; break; }
 					else dmx_state = dmx_EndOfPacket;
 				}
 				else break;
@@ -18,6 +18,13 @@
 #define usb_NotInitialized 0
 #define usb_Idle 1
 #define usb_ChannelRange 2
+#define usb_ChannelSparse 3
+#define usb_ChannelFill 4
+
+
+// software jumper in EEPROM to start bootloader, must match bootloader/main.c
+#define UBOOT_SOFTJUMPER_ADDRESS	0x00
+#define UBOOT_SOFTJUMPER			0xd9
 
 
 // PORTB States for leds
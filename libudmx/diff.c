@@ -0,0 +1,191 @@
+/*
+	diff.c
+
+	Universe diff kernel for libudmx: compares a new frame against the last
+	one and returns what changed as a bitmap and as spans
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+
+	The compare runs 16 (SSE2, NEON) or 32 (AVX2) channels per instruction
+	and yields a 512 bit change mask, spans are then read off the mask a word
+	at a time. AVX2 is picked at run time, SSE2 and NEON at compile time,
+	everything else uses the portable version.
+ */
+
+#include "libudmx.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DIFF_SSE2
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DIFF_AVX2
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define DIFF_NEON
+#endif
+
+#define MASK_WORDS			(UDMX_CHANNELS / 32)
+
+//----------------------------------------------------------------------------------------------------------------
+// change masks, bit (chan % 32) of word (chan / 32) is set if last and next differ
+#if !defined(DIFF_SSE2) && !defined(DIFF_NEON)
+static void mask_scalar(const unsigned char *last, const unsigned char *next, unsigned int *mask) {
+
+	int w, i;
+	unsigned long long a, b;
+
+	for (w = 0; w < MASK_WORDS; w++, last += 32, next += 32) {
+		unsigned int bits = 0;
+		for (i = 0; i < 32; i += 8) {
+			memcpy(&a, last + i, 8);
+			memcpy(&b, next + i, 8);
+			if (a != b) {				// only look at single bytes if something changed
+				int j;
+				for (j = 0; j < 8; j++)
+					if (last[i+j] != next[i+j]) bits |= 1u << (i + j);
+			}
+		}
+		mask[w] = bits;
+	}
+}
+#endif
+
+#ifdef DIFF_SSE2
+static void mask_sse2(const unsigned char *last, const unsigned char *next, unsigned int *mask) {
+
+	int w;
+
+	for (w = 0; w < MASK_WORDS; w++, last += 32, next += 32) {
+		__m128i lo = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)last), _mm_loadu_si128((const __m128i *)next));
+		__m128i hi = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(last + 16)), _mm_loadu_si128((const __m128i *)(next + 16)));
+		mask[w] = ~((unsigned int)_mm_movemask_epi8(lo) | ((unsigned int)_mm_movemask_epi8(hi) << 16));
+	}
+}
+#endif
+
+#ifdef DIFF_AVX2
+__attribute__((target("avx2")))
+static void mask_avx2(const unsigned char *last, const unsigned char *next, unsigned int *mask) {
+
+	int w;
+
+	for (w = 0; w < MASK_WORDS; w++, last += 32, next += 32) {
+		__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)last), _mm256_loadu_si256((const __m256i *)next));
+		mask[w] = ~(unsigned int)_mm256_movemask_epi8(eq);
+	}
+}
+#endif
+
+#ifdef DIFF_NEON
+static void mask_neon(const unsigned char *last, const unsigned char *next, unsigned int *mask) {
+
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t bit = vld1q_u8(weights);
+	int w, h;
+
+	for (w = 0; w < MASK_WORDS; w++) {
+		unsigned int bits = 0;
+		for (h = 0; h < 2; h++, last += 16, next += 16) {
+			uint8x16_t ne = vmvnq_u8(vceqq_u8(vld1q_u8(last), vld1q_u8(next)));
+			uint8x16_t m = vandq_u8(ne, bit);
+			bits |= ((unsigned int)vaddv_u8(vget_low_u8(m)) | ((unsigned int)vaddv_u8(vget_high_u8(m)) << 8)) << (16 * h);
+		}
+		mask[w] = bits;
+	}
+}
+#endif
+
+typedef void (*mask_fn)(const unsigned char *, const unsigned char *, unsigned int *);
+
+static mask_fn pick_kernel(void) {
+#ifdef DIFF_AVX2
+	if (__builtin_cpu_supports("avx2")) return mask_avx2;
+#endif
+#if defined(DIFF_SSE2)
+	return mask_sse2;
+#elif defined(DIFF_NEON)
+	return mask_neon;
+#else
+	return mask_scalar;
+#endif
+}
+
+static mask_fn kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void init_kernel(void) {
+	kernel = pick_kernel();
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// spans from a change mask, runs longer than a word are joined
+// if there are more runs than max_spans, the last span is extended over the rest
+static int mask_spans(const unsigned int *mask, const unsigned char *next, libudmx_span *spans, int max_spans) {
+
+	int w, nspans = 0;
+
+	for (w = 0; w < MASK_WORDS; w++) {
+		unsigned int bits = mask[w];
+		while (bits) {
+			int first = __builtin_ctz(bits);
+			unsigned int rest = ~(bits >> first);
+			int len = rest ? __builtin_ctz(rest) : 32 - first;
+			unsigned short chan = w * 32 + first;
+
+			if (nspans && spans[nspans-1].start + spans[nspans-1].len == chan) {
+				spans[nspans-1].len += len;
+			} else if (nspans < max_spans) {
+				spans[nspans].start = chan;
+				spans[nspans].len = len;
+				spans[nspans].data = next + chan;
+				nspans++;
+			} else if (nspans) {
+				spans[nspans-1].len = chan + len - spans[nspans-1].start;
+			}
+			bits = (first + len < 32) ? bits & ~((1u << (first + len)) - 1) : 0;
+		}
+	}
+	return nspans;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_diff
+//
+// 	-> compare one universe, fill the change bitmap (UDMX_CHANNELS / 32 words)
+//	   and up to max_spans spans pointing into next, return the number of spans
+int libudmx_diff(const unsigned char *last, const unsigned char *next, unsigned int *bitmap,
+				 libudmx_span *spans, int max_spans) {
+
+	pthread_once(&kernel_once, init_kernel);	// manager workers, senders and Pd may all get here first
+	kernel(last, next, bitmap);
+	return spans ? mask_spans(bitmap, next, spans, max_spans) : 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_diff_universes
+//
+// 	-> same for consecutive universes, universe u uses bitmap + u * UDMX_CHANNELS / 32,
+//	   spans + u * max_spans and nspans[u]. returns the total number of spans
+int libudmx_diff_universes(const unsigned char *last, const unsigned char *next, int universes,
+						   unsigned int *bitmaps, libudmx_span *spans, int max_spans, int *nspans) {
+
+	int u, total = 0;
+
+	for (u = 0; u < universes; u++) {
+		int n = libudmx_diff(last + u * UDMX_CHANNELS, next + u * UDMX_CHANNELS, bitmaps + u * MASK_WORDS,
+							 spans ? spans + u * max_spans : NULL, max_spans);
+		if (nspans) nspans[u] = n;
+		total += n;
+	}
+	return total;
+}
@@ -0,0 +1,1469 @@
+/*
+	libudmx.c
+
+	Host library for the [ a n y m a | usb-dmx-interface ]
+	shared by the command line tool and the Max and Pd externals
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+
+	Transfers are asynchronous (libusb-1.0). Every device has one transfer in
+	flight at most; changes made while it is on the bus are collected in the
+	dirty bitmap and sent from its completion callback, so newer values replace
+	whatever was waiting instead of queueing up behind it. Callbacks run on the
+	library's event thread, which is started with the first device handle.
+	Which request carries the changes is decided by the planner in plan.c.
+	Urgent channels are planned on their own and go first, and while there
+	are any, bulk transfers are cut short so they never wait for long.
+
+	A transfer that fails or misses its deadline is not sent again as it was:
+	its channels are marked dirty and the retry, after a short backoff, sends
+	their current values together with everything that changed meanwhile.
+	When the retry budget is used up the device counts as lost and the next
+	flush reopens it, callers never wait for any of this.
+
+	When the bus is idle, the event thread sends the channels that were set
+	again in small slices, a few hundred bytes a second, so values lost on the way
+	heal without anyone touching them. Changes always go first; a slice only
+	gets in between them when they have kept the device busy for a whole
+	refresh period. Channels above the highest one set are never refreshed,
+	sending them would make the device send longer DMX frames.
+
+	Firmware that reports its frame status is asked for it now and then, from
+	flush. The samples give the frame period in host time, drift between the
+	two clocks included, and the phase, so hosts can time their flushes to
+	land just before the next BREAK.
+ */
+
+#include "libudmx.h"
+#include "plan.h"
+#include "../common/uDMX_cmds.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include <libusb.h>    /* this is libusb-1.0, see http://libusb.info/ */
+
+#define USBDEV_SHARED_VENDOR    	0x16C0  /* VOTI */
+#define USBDEV_SHARED_PRODUCT   	0x05DC  /* Obdev's free shared PID for Vendor-Type devices*/
+#define USBDEV_SHARED_PRODUCT_HID   0x05DF  /* Obdev's free shared PID for HID devices*/
+#define USBDEV_SHARED_PRODUCT_MIDI  0x05E4  /* Obdev's free shared PID for MIDI devices*/
+
+#define DEFAULT_DEADLINE		150		// ms a transfer may take
+#define DEFAULT_RETRIES			3		// resends before the connection is reset
+#define DEFAULT_BACKOFF			10		// ms before the first resend, doubles every time
+#define EVENT_INTERVAL			100		// ms the event thread waits for USB events
+#define BUSY_SMOOTHING			8		// weight of the old estimate when measuring busy time
+
+// DMX frame timing of the firmware: break, mark after break, then start code and
+// packet_len channels of 44 us each. packet_len grows to the highest channel set.
+#define DMX_BREAK_US			88.
+#define DMX_MAB_US				8.
+#define DMX_SLOT_US				44.
+
+#define POLL_INTERVAL			1000	// ms between frame status requests
+#define POLL_INTERVAL_START		100		// same, until the period is known
+#define POLL_MAX_ROUNDTRIP		4.		// ms, slower replies don't tell us when the device answered
+#define PERIOD_MIN_FRAMES		8		// frames between samples before we trust the period
+#define PERIOD_MAX_FRAMES		4096	// start measuring again after this many, to follow drift
+#define PHASE_SMOOTHING			4		// weight of the predicted frame start against a new sample
+#define DIFF_MIN_LEN			32		// spans at least this long go through the diff kernel
+#define BULK_MAX_BYTES			64		// data per bulk transfer while there are urgent channels
+#define REFRESH_PERIOD			2000	// ms to send the channels that were set again in the background
+#define REFRESH_SLICE			32		// channels per refresh transfer
+
+struct _libudmx_device {
+	libusb_device_handle	*handle;		// NULL if not connected
+	char			serial[UDMX_SERIAL_LEN];	// serial number of the connected device
+	char			bind_to[UDMX_SERIAL_LEN];	// only connect to this serial number, "" for any
+	int				devices_seen;			// device count at the last connect attempt, -1 to force a scan
+	unsigned int	generation_seen;		// cache generation at the last connect attempt
+	int				reconnect;				// reopen automatically when the device comes back
+	int				connecting;				// libudmx_connect_async has an attempt running, under lock
+	int				connect_result;			// of the last one, UDMX_PENDING once it was reported
+	int				connect_cancelled;		// disconnected meanwhile, the attempt keeps nothing it finds
+	libudmx_policy	policy;
+	unsigned char	universe[UDMX_CHANNELS];
+	unsigned int	dirty[PLAN_DIRTY_WORDS];	// changed channels since last flush
+	unsigned short	extent;					// channels up to the highest one the host has set
+	unsigned int	urgent[PLAN_DIRTY_WORDS];	// high priority channels
+	int				has_urgent;
+	unsigned int	caps;					// cap_* flags of the connected device
+	plan_cost		cost;					// measured cost of a transfer
+	char			error[128];
+
+	pthread_mutex_t	lock;					// protects everything below, and universe/dirty range
+	pthread_cond_t	idle;					// signalled when a transfer completes
+	struct libusb_transfer *transfer;		// preallocated, reused for every send
+	unsigned char	transfer_buffer[LIBUSB_CONTROL_SETUP_SIZE + UDMX_CHANNELS];
+	plan_transfer	planned;				// what the transfer on the bus sends
+	int				refreshing;				// it is a refresh slice, not changes
+	double			started;				// ms, when it was submitted
+	double			batch_started;			// ms, when the device last went from idle to busy, 0 if idle
+	double			busy;					// ms, measured time to send the changes of one flush
+	unsigned short	frame_len;				// channels the device sends per DMX frame, as far as we know
+	int				in_flight;				// transfer is on the bus
+	int				failed;					// a transfer failed since the last flush
+	int				lost;					// device went away, reconnect needed
+	int				closing;				// don't start new transfers
+	int				hold_pending;			// send cmd_HoldOutput before the changes
+	int				commit_pending;			// and release it after them
+	int				attempt;				// failed transfers in a row
+	double			retry_at;				// ms, resend the failed channels at this time
+	int				retry_wait;				// waiting for retry_at
+	int				refresh_period;			// ms for a background refresh up to extent, 0 for none
+	unsigned short	refresh_pos;			// next channel to refresh
+	double			refresh_at;				// ms, time for the next slice
+	struct _libudmx_device *timer_next;		// in timer_list, also protected by timer_lock
+	int				timer_linked;			// in timer_list, changed with both locks held
+	libudmx_stats	stats;
+	libudmx_done_fn	done_fn;				// user completion callback
+	void			*done_ctx;
+
+	// frame clock of the device, from cmd_GetFrameStatus
+	struct libusb_transfer *status_transfer;
+	unsigned char	status_buffer[LIBUSB_CONTROL_SETUP_SIZE + 8];
+	int				polling;				// status_transfer is on the bus
+	double			poll_started;			// ms
+	double			poll_at;				// ms, next frame status request
+	int				frame_valid;			// we have a sample
+	unsigned short	frame_count;			// frame counter of the last sample
+	unsigned short	frame_channels;			// channels per frame of the last sample
+	unsigned long	frame_n;				// frames since the first sample
+	unsigned long	frame_base_n;			// first frame of the period measurement
+	double			frame_base;				// ms, when it started
+	double			frame_origin;			// ms, when frame frame_n started
+	double			frame_period;			// ms
+};
+
+//----------------------------------------------------------------------------------------------------------------
+// discovery cache
+//
+// Where libusb supports hotplug, the devices with our VID are kept in a cache
+// that is updated from the hotplug callback. Their serial numbers are read
+// once, the first time somebody looks for a device after they arrived. While
+// nothing is plugged in or out, looking for a device costs nothing.
+#define MAX_CACHED				64
+
+typedef struct _cache_entry {
+	libusb_device	*usbdev;				// referenced while in the cache
+	int				state;					// 0: not looked at yet, 1: uDMX, -1: something else
+	char			serial[UDMX_SERIAL_LEN];
+} cache_entry;
+
+static pthread_mutex_t	cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry		cache[MAX_CACHED];
+static int				cache_count = 0;
+static unsigned int		cache_generation = 1;	// changes with every arrival or departure
+static int				hotplug = 0;			// the cache is in use
+static libusb_hotplug_callback_handle hotplug_handle;
+
+static int read_serial(libusb_device_handle *handle, const struct libusb_device_descriptor *desc, char *serial);
+
+// called by libusb on the event thread, must not do any I/O
+static int LIBUSB_CALL hotplug_event(libusb_context *context, libusb_device *usbdev, libusb_hotplug_event event, void *user_data) {
+
+	int i;
+
+	(void)context;
+	(void)user_data;
+	pthread_mutex_lock(&cache_lock);
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		if (cache_count < MAX_CACHED) {
+			cache[cache_count].usbdev = libusb_ref_device(usbdev);
+			cache[cache_count].state = 0;
+			cache[cache_count].serial[0] = 0;
+			cache_count++;
+		}
+	} else {
+		for (i = 0; i < cache_count; i++) {
+			if (cache[i].usbdev == usbdev) {
+				libusb_unref_device(usbdev);
+				cache[i] = cache[--cache_count];
+				break;
+			}
+		}
+	}
+	cache_generation++;
+	pthread_mutex_unlock(&cache_lock);
+	return 0;								// keep the callback
+}
+
+static char isOurVIDandPID(const struct libusb_device_descriptor *desc);
+
+// read the serial numbers of devices that arrived since we last looked, call without cache_lock:
+// opening them does I/O, and hotplug_event needs the lock on the event thread meanwhile.
+// The entries are looked up again by their usbdev afterwards, we hold a reference so it
+// can't be reused. Returns the number of devices that could not be opened yet
+static int cache_resolve(void) {
+
+	libusb_device *todo[MAX_CACHED];
+	int state[MAX_CACHED];
+	char serial[MAX_CACHED][UDMX_SERIAL_LEN];
+	int i, j, n = 0, pending = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; i < cache_count; i++)
+		if (!cache[i].state) todo[n++] = libusb_ref_device(cache[i].usbdev);
+	pthread_mutex_unlock(&cache_lock);
+
+	for (j = 0; j < n; j++) {
+		struct libusb_device_descriptor desc;
+		libusb_device_handle *handle;
+
+		state[j] = -1;
+		serial[j][0] = 0;
+		if (libusb_get_device_descriptor(todo[j], &desc) != 0 || !isOurVIDandPID(&desc)) continue;
+		if (libusb_open(todo[j], &handle) < 0) {
+			state[j] = 0;					// maybe it's not ready yet, try again next time
+			pending++;
+			continue;
+		}
+		if (read_serial(handle, &desc, serial[j])) state[j] = 1;
+		libusb_close(handle);
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	for (j = 0; j < n; j++) {
+		for (i = 0; i < cache_count; i++) {
+			if (cache[i].usbdev != todo[j]) continue;
+			if (!cache[i].state) {			// not unplugged, and nobody else was quicker
+				cache[i].state = state[j];
+				memcpy(cache[i].serial, serial[j], UDMX_SERIAL_LEN);
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	for (j = 0; j < n; j++) libusb_unref_device(todo[j]);
+	return pending;
+}
+
+static void cache_clear(void) {
+	pthread_mutex_lock(&cache_lock);
+	while (cache_count) libusb_unref_device(cache[--cache_count].usbdev);
+	cache_generation++;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// shared libusb context and event thread
+static pthread_mutex_t	ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static libusb_context	*ctx = NULL;
+static int				ctx_users = 0;
+static pthread_t		event_thread;
+static volatile int		event_thread_stop;
+
+static double now_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// devices waiting for a retry after a failed transfer or for the next refresh slice
+//
+// Lock order is dev->lock before timer_lock. The event thread walks the list
+// the other way round, so it only tries the device locks and comes back to
+// a device that is busy on its next pass.
+static pthread_mutex_t	timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static libudmx_device	*timer_list = NULL;
+
+static void send_next(libudmx_device *dev);
+static void submit_planned(libudmx_device *dev);
+
+// call with dev->lock held
+static void timer_link(libudmx_device *dev) {
+	if (dev->timer_linked) return;
+	pthread_mutex_lock(&timer_lock);
+	dev->timer_next = timer_list;
+	timer_list = dev;
+	dev->timer_linked = 1;
+	pthread_mutex_unlock(&timer_lock);
+}
+
+// call with dev->lock held
+static void timer_unlink(libudmx_device *dev) {
+	libudmx_device **p;
+	dev->retry_wait = 0;
+	if (!dev->timer_linked) return;
+	pthread_mutex_lock(&timer_lock);
+	for (p = &timer_list; *p; p = &(*p)->timer_next) {
+		if (*p == dev) {
+			*p = dev->timer_next;
+			break;
+		}
+	}
+	dev->timer_linked = 0;
+	pthread_mutex_unlock(&timer_lock);
+}
+
+// when the event thread has to look at the device next, 0 for never. call with dev->lock held
+static double timer_due(const libudmx_device *dev) {
+	if (dev->retry_wait) return dev->retry_at;
+	if (dev->refresh_period && dev->extent && dev->handle && !dev->lost && !dev->closing) return dev->refresh_at;
+	return 0.;
+}
+
+// ms between refresh slices, so everything up to extent is sent once per period
+static double refresh_step(const libudmx_device *dev) {
+	int slices = (dev->extent + REFRESH_SLICE - 1) / REFRESH_SLICE;
+	return (double)dev->refresh_period / (slices > 0 ? slices : 1);
+}
+
+// start the retries and refresh slices that are due, returns ms until the next one
+static double run_timers(void) {
+
+	libudmx_device **p, *dev;
+	double now = now_ms(), next = EVENT_INTERVAL, at;
+
+	pthread_mutex_lock(&timer_lock);
+	for (p = &timer_list; (dev = *p); ) {
+		if (pthread_mutex_trylock(&dev->lock) != 0) {
+			next = 1;
+			p = &dev->timer_next;
+			continue;
+		}
+		at = timer_due(dev);
+		if (at && at <= now) {
+			dev->retry_wait = 0;
+			if (!dev->closing && !dev->lost && !dev->in_flight && dev->handle)
+				send_next(dev);					// may fail again and set retry_wait
+			if (!dev->in_flight)
+				pthread_cond_broadcast(&dev->idle);
+			at = timer_due(dev);
+			if (at && at <= now && dev->in_flight)		// the callback sends it, look again later
+				at = now + refresh_step(dev);
+		}
+		if (at) {
+			if (at - now < next) next = at - now;
+			p = &dev->timer_next;
+		} else {
+			*p = dev->timer_next;
+			dev->timer_linked = 0;
+		}
+		pthread_mutex_unlock(&dev->lock);
+	}
+	pthread_mutex_unlock(&timer_lock);
+	return next;
+}
+
+static void *event_loop(void *arg) {
+	(void)arg;
+	while (!event_thread_stop) {
+		double wait = run_timers();		// also checks for stop at least every EVENT_INTERVAL ms
+		struct timeval tv;
+		if (wait < 1.) wait = 1.;
+		tv.tv_sec = 0;
+		tv.tv_usec = (long)(wait * 1000);
+		libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+	}
+	return NULL;
+}
+
+static int context_retain(void) {
+	int rval = 0;
+	pthread_mutex_lock(&ctx_lock);
+	if (!ctx_users) {
+		if (libusb_init(&ctx) < 0) {
+			rval = -1;
+		} else {
+			// fills the cache with the devices that are already there
+			hotplug = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) &&
+				libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+												 LIBUSB_HOTPLUG_ENUMERATE, USBDEV_SHARED_VENDOR, LIBUSB_HOTPLUG_MATCH_ANY,
+												 LIBUSB_HOTPLUG_MATCH_ANY, hotplug_event, NULL, &hotplug_handle) == LIBUSB_SUCCESS;
+			event_thread_stop = 0;
+			if (pthread_create(&event_thread, NULL, event_loop, NULL) != 0) {
+				if (hotplug) libusb_hotplug_deregister_callback(ctx, hotplug_handle);
+				cache_clear();
+				libusb_exit(ctx);
+				rval = -1;
+			}
+		}
+	}
+	if (!rval) ctx_users++;
+	pthread_mutex_unlock(&ctx_lock);
+	return rval;
+}
+
+static void context_release(void) {
+	pthread_mutex_lock(&ctx_lock);
+	if (--ctx_users == 0) {
+		if (hotplug) libusb_hotplug_deregister_callback(ctx, hotplug_handle);
+		event_thread_stop = 1;
+		pthread_join(event_thread, NULL);
+		cache_clear();
+		hotplug = 0;
+		libusb_exit(ctx);
+		ctx = NULL;
+	}
+	pthread_mutex_unlock(&ctx_lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// USB HELPER FUNCTIONS
+static char isOurVIDandPID(const struct libusb_device_descriptor *desc) {
+	return desc->idVendor == USBDEV_SHARED_VENDOR &&
+	(desc->idProduct == USBDEV_SHARED_PRODUCT ||
+	 desc->idProduct == USBDEV_SHARED_PRODUCT_HID ||
+	 desc->idProduct == USBDEV_SHARED_PRODUCT_MIDI);
+}
+
+static void set_usb_error(libudmx_device *dev, int err) {
+	snprintf(dev->error, sizeof(dev->error), "%s", libusb_error_name(err));
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// check vendor and product strings of an open device and get its serial number
+static int read_serial(libusb_device_handle *handle, const struct libusb_device_descriptor *desc, char *serial) {
+
+	unsigned char string[256];
+
+	if (libusb_get_string_descriptor_ascii(handle, desc->iManufacturer, string, sizeof(string)) < 0
+		|| strcmp((char *)string, "www.anyma.ch") != 0)
+		return 0;
+	if (libusb_get_string_descriptor_ascii(handle, desc->iProduct, string, sizeof(string)) < 0
+		|| (strcmp((char *)string, "udmx") != 0 && strcmp((char *)string, "uDMX") != 0))
+		return 0;
+
+	// we've found a udmx device. get serial number
+	serial[0] = 0;
+	if (desc->iSerialNumber) {
+		if (libusb_get_string_descriptor_ascii(handle, desc->iSerialNumber, (unsigned char *)serial, UDMX_SERIAL_LEN) <= 0)
+			serial[0] = 0;
+	}
+	return 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// open a matching device, checking vendor, product and serial number
+static libusb_device_handle *open_device(libudmx_device *dev, libusb_device *usbdev, const struct libusb_device_descriptor *desc) {
+
+	libusb_device_handle *handle;
+	int rval;
+
+	if ((rval = libusb_open(usbdev, &handle)) < 0) { /* we need to open the device in order to query strings */
+		set_usb_error(dev, rval);
+		return NULL;
+	}
+	if (!read_serial(handle, desc, dev->serial))
+		goto skipDevice;
+
+	// see if we're looking for a specific serial number
+	if (dev->bind_to[0] && strcmp(dev->bind_to, dev->serial) != 0)
+		goto skipDevice;
+
+	return handle;
+
+skipDevice:
+	libusb_close(handle);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// transfers, call with dev->lock held
+static int has_work(const libudmx_device *dev) {
+	return dev->hold_pending || dev->commit_pending || plan_is_dirty(dev->dirty);
+}
+
+// put the channels of a failed transfer back, they go out again with their current values
+static void transfer_failed(libudmx_device *dev) {
+
+	plan_transfer *t = &dev->planned;
+	int i;
+
+	dev->failed = 1;
+	if (!dev->closing) dev->stats.failures++;	// cancelled on purpose doesn't count
+	if (t->kind == PLAN_HOLD) dev->hold_pending = 1;
+	else if (t->kind == PLAN_COMMIT) dev->commit_pending = 1;
+	else if (t->kind == PLAN_SPARSE) {
+		for (i = 0; i < t->count; i++) plan_mark(dev->dirty, t->channels[i], 1);
+	} else plan_mark(dev->dirty, t->start, t->len);
+
+	if (dev->lost || dev->closing) return;
+	if (++dev->attempt > dev->policy.retries) {		// give up on this connection, flush reopens it
+		dev->attempt = 0;
+		dev->lost = 1;
+		dev->stats.resets++;
+		snprintf(dev->error, sizeof(dev->error), "no reply after %d retries", dev->policy.retries);
+		return;
+	}
+	dev->stats.retries++;
+	dev->retry_at = now_ms() + (double)dev->policy.backoff * (1 << (dev->attempt - 1));
+	dev->retry_wait = 1;
+	timer_link(dev);
+}
+
+static void LIBUSB_CALL transfer_done(struct libusb_transfer *transfer) {
+
+	libudmx_device *dev = (libudmx_device *)transfer->user_data;
+	libudmx_done_fn done_fn = NULL;
+	void *done_ctx = NULL;
+	unsigned short start = 0, len = 0;
+	int status = UDMX_OK;
+
+	pthread_mutex_lock(&dev->lock);
+	dev->in_flight = 0;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		plan_cost_update(&dev->cost, &dev->planned, (now_ms() - dev->started) * 1e3);
+		dev->attempt = 0;
+		dev->stats.transfers++;
+		if (dev->refreshing) dev->stats.refreshed += dev->planned.len;
+		else if (!dev->timer_linked && timer_due(dev)) {	// the first channels were set, start refreshing them
+			dev->refresh_at = now_ms() + refresh_step(dev);
+			timer_link(dev);
+		}
+	} else {
+		status = UDMX_ERR_USB;
+		if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+			dev->lost = 1;
+			snprintf(dev->error, sizeof(dev->error), "device disconnected");
+		} else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+			snprintf(dev->error, sizeof(dev->error), "transfer timed out");
+		} else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+			snprintf(dev->error, sizeof(dev->error), "transfer failed (%d)", transfer->status);
+		}
+		transfer_failed(dev);
+	}
+	if (dev->done_fn && !dev->refreshing && transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+		done_fn = dev->done_fn;				// called below, without the lock
+		done_ctx = dev->done_ctx;
+		start = dev->planned.start;
+		len = dev->planned.len;
+	}
+
+	// send whatever changed while we were busy, from the current universe
+	if (!dev->closing && !dev->lost && !dev->retry_wait)
+		send_next(dev);
+	if ((!dev->in_flight || dev->refreshing) && !dev->retry_wait && dev->batch_started) {	// all changes are out
+		if (!dev->failed) dev->busy += (now_ms() - dev->batch_started - dev->busy) / BUSY_SMOOTHING;
+		dev->batch_started = 0;
+	}
+	if (!dev->in_flight)
+		pthread_cond_broadcast(&dev->idle);
+	pthread_mutex_unlock(&dev->lock);
+
+	if (done_fn) done_fn(done_ctx, status, start, len);
+}
+
+static void start_transfer(libudmx_device *dev) {
+
+	plan_transfer *t = &dev->planned;
+	unsigned char *data = dev->transfer_buffer + LIBUSB_CONTROL_SETUP_SIZE;
+	unsigned char type = LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT;
+	unsigned int lane[PLAN_DIRTY_WORDS], urgent = 0;
+	int i;
+
+	// urgent changes first, on their own
+	for (i = 0; i < PLAN_DIRTY_WORDS; i++) {
+		lane[i] = dev->dirty[i] & dev->urgent[i];
+		urgent |= lane[i];
+	}
+
+	if (dev->hold_pending) {					// hold the output before the upload
+		dev->hold_pending = 0;
+		t->kind = PLAN_HOLD;
+		t->start = t->len = t->count = 0;
+		libusb_fill_control_setup(dev->transfer_buffer, type, cmd_HoldOutput, 1, 0, 0);
+	} else if (!plan_next(urgent ? lane : dev->dirty, dev->universe, dev->caps, &dev->cost, t)) {
+		if (!dev->commit_pending) return;
+		dev->commit_pending = 0;				// everything is there, let it go out
+		t->kind = PLAN_COMMIT;
+		t->start = t->len = t->count = 0;
+		libusb_fill_control_setup(dev->transfer_buffer, type, cmd_HoldOutput, 0, 0, 0);
+	} else {
+		if (dev->has_urgent && !urgent) {		// bulk: leave the rest for later, an urgent change may come
+			if (t->kind == PLAN_RANGE && t->len > BULK_MAX_BYTES) t->len = BULK_MAX_BYTES;
+			if (t->kind == PLAN_SPARSE && t->count > BULK_MAX_BYTES / 3) {
+				t->count = BULK_MAX_BYTES / 3;
+				t->len = t->channels[t->count - 1] - t->start + 1;
+			}
+		}
+		switch (t->kind) {
+			case PLAN_SINGLE:
+				libusb_fill_control_setup(dev->transfer_buffer, type, cmd_SetSingleChannel, dev->universe[t->start], t->start, 0);
+				break;
+			case PLAN_FILL:
+				libusb_fill_control_setup(dev->transfer_buffer, type, cmd_FillChannelRange, t->len, t->start, 1);
+				data[0] = dev->universe[t->start];
+				break;
+			case PLAN_SPARSE:
+				libusb_fill_control_setup(dev->transfer_buffer, type, cmd_SetChannelSparse, t->count, 0, 3 * t->count);
+				for (i = 0; i < t->count; i++) {
+					*data++ = t->channels[i] & 0xff;
+					*data++ = t->channels[i] >> 8;
+					*data++ = dev->universe[t->channels[i]];
+				}
+				break;
+			default:
+				libusb_fill_control_setup(dev->transfer_buffer, type, cmd_SetChannelRange, t->len, t->start, t->len);
+				memcpy(data, dev->universe + t->start, t->len);
+				break;
+		}
+	}
+	dev->refreshing = 0;
+	submit_planned(dev);
+	if (!dev->batch_started && dev->in_flight) dev->batch_started = dev->started;
+}
+
+// send the next slice of the universe and schedule the one after it
+static void start_refresh(libudmx_device *dev, double now) {
+
+	plan_transfer *t = &dev->planned;
+	unsigned char *data = dev->transfer_buffer + LIBUSB_CONTROL_SETUP_SIZE;
+
+	if (dev->refresh_pos >= dev->extent) dev->refresh_pos = 0;
+	t->kind = PLAN_RANGE;
+	t->start = dev->refresh_pos;
+	t->len = dev->extent - t->start < REFRESH_SLICE ? dev->extent - t->start : REFRESH_SLICE;
+	t->count = 0;
+	libusb_fill_control_setup(dev->transfer_buffer, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
+							  cmd_SetChannelRange, t->len, t->start, t->len);
+	memcpy(data, dev->universe + t->start, t->len);
+	dev->refresh_pos = t->start + t->len;
+	dev->refresh_at = now + refresh_step(dev);
+	dev->refreshing = 1;
+	submit_planned(dev);
+}
+
+// a refresh slice is due: on an idle device when its time has come, between
+// changes only when they have held it up for a whole period
+static int refresh_due(const libudmx_device *dev, double now) {
+	if (!dev->refresh_period || !dev->extent || dev->hold_pending || dev->commit_pending) return 0;	// keep the synchronized upload short
+	return now >= dev->refresh_at + (plan_is_dirty(dev->dirty) ? dev->refresh_period : 0);
+}
+
+static void send_next(libudmx_device *dev) {
+	double now = now_ms();
+	if (refresh_due(dev, now)) start_refresh(dev, now);
+	else if (has_work(dev)) start_transfer(dev);
+}
+
+static void submit_planned(libudmx_device *dev) {
+
+	plan_transfer *t = &dev->planned;
+	int rval;
+
+	libusb_fill_control_transfer(dev->transfer, dev->handle, dev->transfer_buffer, transfer_done, dev, dev->policy.deadline);
+	plan_clear(dev->dirty, t);
+	dev->started = now_ms();
+	if (t->start + t->len > dev->frame_len) dev->frame_len = t->start + t->len;
+
+	if ((rval = libusb_submit_transfer(dev->transfer)) < 0) {
+		set_usb_error(dev, rval);
+		if (rval == LIBUSB_ERROR_NO_DEVICE) dev->lost = 1;
+		transfer_failed(dev);
+		return;
+	}
+	dev->in_flight = 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// frame clock, call with dev->lock held
+
+// a frame status reply that arrived at time t
+static void frame_sample(libudmx_device *dev, double t, const unsigned char *reply) {
+
+	unsigned short count = reply[0] | reply[1] << 8, next = reply[2] | reply[3] << 8, channels = reply[4] | reply[5] << 8;
+	unsigned short dn;
+	double frame = (DMX_BREAK_US + DMX_MAB_US + DMX_SLOT_US * (1 + channels)) / 1e3;
+	double offset, start, predicted;
+
+	// how far into its frame the device was, from the firmware's timing
+	switch (reply[6]) {
+		case 0:		dev->frame_valid = 0; return;		// not sending DMX yet
+		case 1:		count++; offset = 0.; break;		// about to start the next frame
+		case 2:		offset = DMX_SLOT_US * next / 1e3; break;
+		case 3:		offset = DMX_SLOT_US * (1 + channels) / 1e3; break;
+		case 4:		offset = (DMX_SLOT_US * (1 + channels) + DMX_BREAK_US / 2) / 1e3; break;
+		default:	offset = frame - DMX_MAB_US / 2e3; break;
+	}
+	start = t - offset;
+
+	dn = count - dev->frame_count;
+	if (dev->frame_valid && channels == dev->frame_channels) {
+		predicted = dev->frame_origin + dn * dev->frame_period;
+		if (start - predicted < dev->frame_period / 2 && predicted - start < dev->frame_period / 2) {
+			dev->frame_count = count;
+			dev->frame_n += dn;
+			if (dev->frame_n - dev->frame_base_n >= PERIOD_MIN_FRAMES)
+				dev->frame_period = (start - dev->frame_base) / (dev->frame_n - dev->frame_base_n);
+			if (dev->frame_n - dev->frame_base_n >= PERIOD_MAX_FRAMES) {
+				dev->frame_base = start;
+				dev->frame_base_n = dev->frame_n;
+			}
+			dev->frame_origin = predicted + (start - predicted) / PHASE_SMOOTHING;
+			return;
+		}
+	}
+	// first sample, the frame length changed or we lost count: start over
+	dev->frame_valid = 1;
+	dev->frame_count = count;
+	dev->frame_channels = channels;
+	dev->frame_n = dev->frame_base_n = 0;
+	dev->frame_base = dev->frame_origin = start;
+	dev->frame_period = frame;
+}
+
+// first frame start at or after t
+static double frame_start_after(const libudmx_device *dev, double t) {
+	double k = (t - dev->frame_origin) / dev->frame_period;
+	long n = (long)k;
+	if (n < k) n++;
+	return dev->frame_origin + n * dev->frame_period;
+}
+
+static void LIBUSB_CALL status_done(struct libusb_transfer *transfer) {
+
+	libudmx_device *dev = (libudmx_device *)transfer->user_data;
+	double now = now_ms();
+
+	pthread_mutex_lock(&dev->lock);
+	dev->polling = 0;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED && transfer->actual_length >= 7
+		&& now - dev->poll_started <= POLL_MAX_ROUNDTRIP)
+		frame_sample(dev, (dev->poll_started + now) / 2, libusb_control_transfer_get_data(transfer));
+	pthread_cond_broadcast(&dev->idle);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+// ask for the frame status if it is time, only while no transfer is queued before it
+static void start_poll(libudmx_device *dev) {
+
+	double now = now_ms();
+
+	if (!(dev->caps & cap_FrameStatus) || dev->polling || dev->in_flight || now < dev->poll_at) return;
+	dev->poll_at = now + (dev->frame_valid && dev->frame_n >= PERIOD_MIN_FRAMES ? POLL_INTERVAL : POLL_INTERVAL_START);
+	libusb_fill_control_setup(dev->status_buffer, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN,
+							  cmd_GetFrameStatus, 0, 0, 8);
+	libusb_fill_control_transfer(dev->status_transfer, dev->handle, dev->status_buffer, status_done, dev, dev->policy.deadline);
+	dev->poll_started = now;
+	if (libusb_submit_transfer(dev->status_transfer) == 0) dev->polling = 1;
+}
+
+// wait until the transfer on the bus and a pending retry are done, timeout in ms (0 = forever)
+static int wait_idle(libudmx_device *dev, int timeout) {
+
+	struct timespec until;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	until.tv_sec = now.tv_sec + timeout / 1000;
+	until.tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L) { until.tv_sec++; until.tv_nsec -= 1000000000L; }
+
+	while (dev->in_flight || dev->retry_wait) {
+		if (!timeout) pthread_cond_wait(&dev->idle, &dev->lock);
+		else if (pthread_cond_timedwait(&dev->idle, &dev->lock, &until) != 0) return -1;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// device handle
+libudmx_device *libudmx_new(const char *serial) {
+
+	libudmx_device *dev = (libudmx_device *)calloc(1, sizeof(libudmx_device));
+	if (!dev) return NULL;
+
+	if (context_retain() < 0) {
+		free(dev);
+		return NULL;
+	}
+	if (!(dev->transfer = libusb_alloc_transfer(0)) || !(dev->status_transfer = libusb_alloc_transfer(0))) {
+		libusb_free_transfer(dev->transfer);
+		context_release();
+		free(dev);
+		return NULL;
+	}
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->idle, NULL);
+	dev->devices_seen = -1;
+	dev->connect_result = UDMX_PENDING;
+	libudmx_set_policy(dev, NULL);
+	dev->refresh_period = REFRESH_PERIOD;
+	plan_cost_init(&dev->cost);
+	libudmx_bind(dev, serial);
+	return dev;
+}
+
+static void wait_connect(libudmx_device *dev);
+
+void libudmx_free(libudmx_device *dev) {
+	if (!dev) return;
+	wait_connect(dev);						// the attempt uses the handle
+	libudmx_disconnect(dev);
+	libusb_free_transfer(dev->transfer);
+	libusb_free_transfer(dev->status_transfer);
+	pthread_cond_destroy(&dev->idle);
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+	context_release();
+}
+
+int libudmx_bind(libudmx_device *dev, const char *serial) {
+	wait_connect(dev);						// it reads bind_to
+	libudmx_disconnect(dev);
+	if (serial)
+		snprintf(dev->bind_to, sizeof(dev->bind_to), "%s", serial);
+	else
+		dev->bind_to[0] = 0;
+	return UDMX_OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// look for our device in the discovery cache
+static libusb_device_handle *open_cached(libudmx_device *dev, int *unchanged) {
+
+	libusb_device_handle *handle = NULL;
+	libusb_device *found[MAX_CACHED];
+	char serials[MAX_CACHED][UDMX_SERIAL_LEN];
+	unsigned int generation;
+	int i, n = 0, pending, rval;
+
+	pthread_mutex_lock(&cache_lock);
+	generation = cache_generation;
+	pthread_mutex_unlock(&cache_lock);
+	if (generation == dev->generation_seen) {	// nothing was plugged in since we last looked
+		*unchanged = 1;
+		return NULL;
+	}
+	pending = cache_resolve();
+
+	pthread_mutex_lock(&cache_lock);				// pick the candidates, open them without the lock
+	for (i = 0; i < cache_count; i++) {
+		if (cache[i].state != 1) continue;
+		if (dev->bind_to[0] && strcmp(dev->bind_to, cache[i].serial) != 0) continue;
+		found[n] = libusb_ref_device(cache[i].usbdev);
+		memcpy(serials[n++], cache[i].serial, UDMX_SERIAL_LEN);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	dev->generation_seen = pending ? 0 : generation;	// anything that arrived meanwhile changed it again
+
+	for (i = 0; i < n; i++) {
+		if (!handle) {
+			if ((rval = libusb_open(found[i], &handle)) < 0) {
+				set_usb_error(dev, rval);
+				handle = NULL;
+			} else memcpy(dev->serial, serials[i], UDMX_SERIAL_LEN);
+		}
+		libusb_unref_device(found[i]);
+	}
+	return handle;
+}
+
+// close the handle, keep what we need to reopen it
+static void close_device(libudmx_device *dev) {
+
+	libusb_device_handle *handle;
+
+	pthread_mutex_lock(&dev->lock);
+	dev->closing = 1;
+	timer_unlink(dev);
+	if (dev->in_flight) {
+		libusb_cancel_transfer(dev->transfer);
+		wait_idle(dev, 0);
+	}
+	if (dev->polling) {
+		libusb_cancel_transfer(dev->status_transfer);
+		while (dev->polling) pthread_cond_wait(&dev->idle, &dev->lock);
+	}
+	dev->frame_valid = 0;
+	dev->poll_at = 0;
+	dev->attempt = 0;
+	dev->batch_started = 0;
+	dev->frame_len = 0;						// a new device starts with an empty frame
+	handle = dev->handle;
+	dev->handle = NULL;
+	pthread_mutex_unlock(&dev->lock);
+
+	if (handle) libusb_close(handle);
+	dev->serial[0] = 0;
+	dev->devices_seen = -1;
+	dev->generation_seen = 0;
+}
+
+static int connect_device(libudmx_device *dev) {
+
+	libusb_device **list;
+	libusb_device_handle *handle = NULL;
+	ssize_t device_count, i;
+	int unchanged = 0;
+
+	if (dev->handle && !dev->lost) return UDMX_OK;
+	if (dev->handle) close_device(dev);		// it went away, clean up before looking again
+
+	if (hotplug) {
+		if (!(handle = open_cached(dev, &unchanged))) {
+			if (unchanged) return UDMX_BUS_UNCHANGED;
+			snprintf(dev->error, sizeof(dev->error), "Could not find USB device www.anyma.ch/udmx");
+			return UDMX_ERR_NOT_FOUND;
+		}
+	} else if ((device_count = libusb_get_device_list(ctx, &list)) < 0) {
+		set_usb_error(dev, (int)device_count);
+		return UDMX_ERR_NOT_FOUND;
+	} else {										// no hotplug: walk the bus if the device count changed
+		if (device_count == dev->devices_seen) {
+			libusb_free_device_list(list, 1);
+			return UDMX_BUS_UNCHANGED;
+		}
+		dev->devices_seen = (int)device_count;
+
+		for (i = 0; i < device_count && !handle; i++) {
+			struct libusb_device_descriptor desc;
+			if (libusb_get_device_descriptor(list[i], &desc) == 0 && isOurVIDandPID(&desc))
+				handle = open_device(dev, list[i], &desc);
+		}
+		libusb_free_device_list(list, 1);
+
+		if (!handle) {
+			snprintf(dev->error, sizeof(dev->error), "Could not find USB device www.anyma.ch/udmx");
+			return UDMX_ERR_NOT_FOUND;
+		}
+	}
+	// ask which requests the firmware knows, older versions don't reply
+	{
+		unsigned char reply[8];
+		int nBytes = libusb_control_transfer(handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN,
+											 cmd_GetCapabilities, 0, 0, reply, sizeof(reply), dev->policy.deadline);
+		dev->caps = nBytes >= 1 ? reply[0] : 0;
+	}
+	pthread_mutex_lock(&dev->lock);
+	if (dev->connect_cancelled) {				// libudmx_disconnect didn't wait for us
+		pthread_mutex_unlock(&dev->lock);
+		libusb_close(handle);
+		dev->serial[0] = 0;						// as close_device, the next attempt looks again
+		dev->devices_seen = -1;
+		dev->generation_seen = 0;
+		return UDMX_ERR_NOT_OPEN;
+	}
+	dev->handle = handle;
+	dev->lost = dev->failed = dev->closing = 0;
+	dev->hold_pending = dev->commit_pending = 0;
+	dev->reconnect = 1;
+	if (dev->extent) plan_mark(dev->dirty, 0, dev->extent);	// we don't know what the device has, send what we have set once
+	dev->refresh_at = now_ms() + dev->refresh_period;
+	if (timer_due(dev)) timer_link(dev);		// nothing to refresh before something is set
+	pthread_mutex_unlock(&dev->lock);
+	return UDMX_OK;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_enumerate
+//
+// 	-> serial numbers of all uDMX on the bus, returns how many there are (may be more than max)
+int libudmx_enumerate(char (*serials)[UDMX_SERIAL_LEN], int max) {
+
+	libusb_device **list;
+	ssize_t device_count, i;
+	int found = 0;
+
+	if (context_retain() < 0) return UDMX_ERR_USB;
+	if (hotplug) {
+		cache_resolve();
+		pthread_mutex_lock(&cache_lock);
+		for (i = 0; i < cache_count; i++) {
+			if (cache[i].state != 1) continue;
+			if (found < max) memcpy(serials[found], cache[i].serial, UDMX_SERIAL_LEN);
+			found++;
+		}
+		pthread_mutex_unlock(&cache_lock);
+		context_release();
+		return found;
+	}
+	if ((device_count = libusb_get_device_list(ctx, &list)) < 0) {
+		context_release();
+		return UDMX_ERR_USB;
+	}
+	for (i = 0; i < device_count; i++) {
+		struct libusb_device_descriptor desc;
+		libusb_device_handle *handle;
+		char serial[UDMX_SERIAL_LEN];
+
+		if (libusb_get_device_descriptor(list[i], &desc) != 0 || !isOurVIDandPID(&desc)) continue;
+		if (libusb_open(list[i], &handle) < 0) continue;
+		if (read_serial(handle, &desc, serial)) {
+			if (found < max) memcpy(serials[found], serial, UDMX_SERIAL_LEN);
+			found++;
+		}
+		libusb_close(handle);
+	}
+	libusb_free_device_list(list, 1);
+	context_release();
+	return found;
+}
+
+// wait for an attempt of libudmx_connect_async, nothing else may touch the connection meanwhile
+static void wait_connect(libudmx_device *dev) {
+	pthread_mutex_lock(&dev->lock);
+	while (dev->connecting) pthread_cond_wait(&dev->idle, &dev->lock);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int libudmx_connect(libudmx_device *dev) {
+	wait_connect(dev);
+	return connect_device(dev);
+}
+
+static void *connect_thread(void *arg) {
+
+	libudmx_device *dev = (libudmx_device *)arg;
+	int rval = connect_device(dev);
+
+	pthread_mutex_lock(&dev->lock);
+	if (!dev->connect_cancelled) dev->connect_result = rval;	// nobody asks for it after a disconnect
+	dev->connect_cancelled = 0;
+	dev->connecting = 0;
+	pthread_cond_broadcast(&dev->idle);
+	pthread_mutex_unlock(&dev->lock);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_connect_async
+//
+// 	-> libudmx_connect on a thread of its own, for callers that must not wait for USB.
+//	   returns UDMX_PENDING while it runs, then its result once, call again to find out
+int libudmx_connect_async(libudmx_device *dev) {
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	int rval = UDMX_PENDING;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->connecting) {
+		pthread_mutex_unlock(&dev->lock);
+		return UDMX_PENDING;
+	}
+	if (dev->connect_result != UDMX_PENDING) {		// the last attempt has finished
+		rval = dev->connect_result;
+		dev->connect_result = UDMX_PENDING;
+		if (rval != UDMX_OK || libudmx_is_connected(dev)) {
+			pthread_mutex_unlock(&dev->lock);
+			return rval;
+		}
+		rval = UDMX_PENDING;						// found, but lost again since
+	}
+	if (dev->handle && !dev->lost) rval = UDMX_OK;
+	else if (hotplug && !dev->handle) {				// the cache tells us for free if it's worth looking
+		pthread_mutex_lock(&cache_lock);
+		if (cache_generation == dev->generation_seen) rval = UDMX_BUS_UNCHANGED;
+		pthread_mutex_unlock(&cache_lock);
+	}
+	if (rval != UDMX_PENDING) {
+		pthread_mutex_unlock(&dev->lock);
+		return rval;
+	}
+	dev->connecting = 1;
+	dev->connect_cancelled = 0;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, connect_thread, dev) != 0) {
+		dev->connecting = 0;
+		pthread_mutex_unlock(&dev->lock);
+		pthread_attr_destroy(&attr);
+		return connect_device(dev);					// no thread, look for it right here
+	}
+	pthread_attr_destroy(&attr);
+	pthread_mutex_unlock(&dev->lock);
+	return UDMX_PENDING;
+}
+
+void libudmx_disconnect(libudmx_device *dev) {
+	pthread_mutex_lock(&dev->lock);
+	dev->connect_result = UDMX_PENDING;		// not interesting any more
+	dev->reconnect = 0;
+	if (dev->connecting) {					// don't wait for it, it closes what it finds
+		dev->connect_cancelled = 1;
+		pthread_mutex_unlock(&dev->lock);
+		return;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	close_device(dev);
+}
+
+int libudmx_is_connected(const libudmx_device *dev) {
+	return dev->handle != NULL && !dev->lost;
+}
+
+const char *libudmx_serial(const libudmx_device *dev) {
+	return dev->serial;
+}
+
+const char *libudmx_strerror(const libudmx_device *dev) {
+	return dev->error;
+}
+
+void libudmx_set_timeout(libudmx_device *dev, int timeout) {
+	pthread_mutex_lock(&dev->lock);
+	dev->policy.deadline = timeout > 0 ? timeout : DEFAULT_DEADLINE;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_set_policy
+//
+// 	-> deadline per transfer, retry budget and backoff, NULL for the defaults
+void libudmx_set_policy(libudmx_device *dev, const libudmx_policy *policy) {
+	pthread_mutex_lock(&dev->lock);
+	dev->policy.deadline = policy && policy->deadline > 0 ? policy->deadline : DEFAULT_DEADLINE;
+	dev->policy.retries = !policy ? DEFAULT_RETRIES : policy->retries < 0 ? 0 : policy->retries > 16 ? 16 : policy->retries;
+	dev->policy.backoff = !policy ? DEFAULT_BACKOFF : policy->backoff < 0 ? 0 : policy->backoff;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+void libudmx_get_policy(libudmx_device *dev, libudmx_policy *policy) {
+	pthread_mutex_lock(&dev->lock);
+	*policy = dev->policy;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_set_refresh
+//
+// 	-> send the channels that were set again every period ms while the bus is idle, 0 to stop
+void libudmx_set_refresh(libudmx_device *dev, int period) {
+	pthread_mutex_lock(&dev->lock);
+	dev->refresh_period = period > 0 ? period : 0;
+	dev->refresh_at = now_ms() + refresh_step(dev);
+	if (timer_due(dev)) timer_link(dev);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_interval
+//
+// 	-> ms between flushes the link sustains: the time it takes to send the
+//	   changes of one flush, but not less than a DMX frame of the device
+double libudmx_interval(libudmx_device *dev) {
+
+	double frame, busy;
+
+	pthread_mutex_lock(&dev->lock);
+	frame = (DMX_BREAK_US + DMX_MAB_US + DMX_SLOT_US * (1 + dev->frame_len)) / 1e3;
+	busy = dev->busy;
+	pthread_mutex_unlock(&dev->lock);
+	return busy > frame ? busy : frame;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_next_frame
+//
+// 	-> ms until the device starts its next DMX frame, -1 if it can't tell us
+double libudmx_next_frame(libudmx_device *dev, double *period) {
+
+	double next = -1.;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->frame_valid) {
+		double now = now_ms();
+		next = frame_start_after(dev, now) - now;
+		if (period) *period = dev->frame_period;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return next;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_next_flush
+//
+// 	-> ms until the next flush should start, at least not_before: the changes
+//	   then arrive just before a BREAK and go out with the following frame
+double libudmx_next_flush(libudmx_device *dev, double not_before) {
+
+	double lead, now, at;
+
+	pthread_mutex_lock(&dev->lock);
+	if (!dev->frame_valid) {
+		pthread_mutex_unlock(&dev->lock);
+		return not_before;
+	}
+	// time to get the changes there, and the BREAK and MAB before the frame starts
+	lead = (dev->busy > 0. ? dev->busy : dev->cost.overhead / 1e3) + (DMX_BREAK_US + DMX_MAB_US) / 1e3;
+	now = now_ms();
+	at = frame_start_after(dev, now + not_before + lead) - lead;
+	pthread_mutex_unlock(&dev->lock);
+	return at - now;
+}
+
+void libudmx_get_stats(libudmx_device *dev, libudmx_stats *stats) {
+	pthread_mutex_lock(&dev->lock);
+	*stats = dev->stats;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+unsigned int libudmx_capabilities(const libudmx_device *dev) {
+	return dev->caps;
+}
+
+void libudmx_cost(libudmx_device *dev, double *overhead, double *per_byte) {
+	pthread_mutex_lock(&dev->lock);
+	if (overhead) *overhead = dev->cost.overhead;
+	if (per_byte) *per_byte = dev->cost.per_byte;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+void libudmx_set_callback(libudmx_device *dev, libudmx_done_fn fn, void *ctx) {
+	pthread_mutex_lock(&dev->lock);
+	dev->done_fn = fn;
+	dev->done_ctx = ctx;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// universe
+const unsigned char *libudmx_universe(const libudmx_device *dev) {
+	return dev->universe;
+}
+
+void libudmx_mark_dirty(libudmx_device *dev, unsigned short start, unsigned short len) {
+	if (start >= UDMX_CHANNELS || !len) return;
+	if (len > UDMX_CHANNELS - start) len = UDMX_CHANNELS - start;
+	pthread_mutex_lock(&dev->lock);
+	plan_mark(dev->dirty, start, len);
+	if (start + len > dev->extent) dev->extent = start + len;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+int libudmx_is_dirty(const libudmx_device *dev) {
+	return plan_is_dirty(dev->dirty);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_set_priority
+//
+// 	-> urgent channels are sent on their own, ahead of everything else
+void libudmx_set_priority(libudmx_device *dev, unsigned short start, unsigned short len, int urgent) {
+
+	unsigned short chan;
+	int w;
+
+	if (start >= UDMX_CHANNELS) return;
+	if (len > UDMX_CHANNELS - start) len = UDMX_CHANNELS - start;
+	pthread_mutex_lock(&dev->lock);
+	for (chan = start; chan < start + len; chan++) {
+		if (urgent) dev->urgent[chan / 32] |= 1u << (chan % 32);
+		else dev->urgent[chan / 32] &= ~(1u << (chan % 32));
+	}
+	dev->has_urgent = 0;
+	for (w = 0; w < PLAN_DIRTY_WORDS; w++)
+		if (dev->urgent[w]) dev->has_urgent = 1;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// whole universe with the diff kernel, call with dev->lock held
+static int apply_frame(libudmx_device *dev, const unsigned char *frame) {
+
+	unsigned int mask[PLAN_DIRTY_WORDS];
+	int w, changed = 0, end = 0;
+
+	libudmx_diff(dev->universe, frame, mask, NULL, 0);
+	for (w = 0; w < PLAN_DIRTY_WORDS; w++) {
+		if (mask[w]) {
+			dev->stats.superseded += __builtin_popcount(mask[w] & dev->dirty[w]);
+			dev->dirty[w] |= mask[w];
+			changed += __builtin_popcount(mask[w]);
+			end = w * 32 + 32 - __builtin_clz(mask[w]);
+		}
+	}
+	if (end > dev->extent) dev->extent = end;	// a frame sets all channels, but unused ones stay 0
+	if (changed) memcpy(dev->universe, frame, UDMX_CHANNELS);
+	return changed;
+}
+
+int libudmx_apply_frame(libudmx_device *dev, const unsigned char *frame) {
+
+	int changed;
+
+	pthread_mutex_lock(&dev->lock);
+	changed = apply_frame(dev, frame);
+	pthread_mutex_unlock(&dev->lock);
+	return changed;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_apply
+//
+// 	-> copy spans into the universe, remember which channels changed
+int libudmx_apply(libudmx_device *dev, const libudmx_span *spans, int nspans) {
+
+	int i, changed = 0;
+
+	pthread_mutex_lock(&dev->lock);
+	for (i = 0; i < nspans; i++) {
+		unsigned short chan = spans[i].start, len = spans[i].len, j;
+		const unsigned char *data = spans[i].data;
+		if (chan >= UDMX_CHANNELS) continue;
+		if (len > UDMX_CHANNELS - chan) len = UDMX_CHANNELS - chan;
+		if (len == UDMX_CHANNELS) {
+			changed += apply_frame(dev, data);
+			continue;
+		}
+		if (chan + len > dev->extent) dev->extent = chan + len;
+		if (len >= DIFF_MIN_LEN) {			// long spans: let the diff kernel find the changes
+			unsigned char frame[UDMX_CHANNELS];
+			memcpy(frame, dev->universe, UDMX_CHANNELS);
+			memcpy(frame + chan, data, len);
+			changed += apply_frame(dev, frame);
+			continue;
+		}
+
+		for (j = 0; j < len; j++, chan++) {
+			if (dev->universe[chan] != data[j]) {
+				dev->universe[chan] = data[j];
+				if (dev->dirty[chan / 32] & (1u << (chan % 32))) dev->stats.superseded++;
+				dev->dirty[chan / 32] |= 1u << (chan % 32);
+				changed++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return changed;
+}
+
+// start a transfer if the device is free, call with dev->lock held
+static int send_changes(libudmx_device *dev) {
+
+	int rval = UDMX_OK;
+
+	if (dev->failed) {						// report errors of earlier transfers once
+		dev->failed = 0;
+		rval = UDMX_ERR_USB;
+	}
+	if (!dev->handle || dev->lost) {
+		rval = UDMX_ERR_NOT_OPEN;			// keep changes for when we're connected
+	} else if (!dev->in_flight && !dev->retry_wait && has_work(dev)) {
+		dev->closing = 0;
+		start_poll(dev);
+		start_transfer(dev);
+		if (dev->failed) {
+			dev->failed = 0;
+			rval = UDMX_ERR_USB;
+		}
+	}
+	return rval;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_flush
+//
+// 	-> start sending everything that changed since the last flush, never blocks
+//	   if a transfer is on the bus, the changes go out when it completes
+int libudmx_flush(libudmx_device *dev) {
+
+	int rval;
+
+	if (dev->reconnect && !libudmx_is_connected(dev) && !dev->connecting)
+		libudmx_connect(dev);				// free unless a device was plugged in or has been reset
+
+	pthread_mutex_lock(&dev->lock);
+	rval = send_changes(dev);
+	pthread_mutex_unlock(&dev->lock);
+	return rval;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_hold, libudmx_commit
+//
+// 	-> the next flush ends the current DMX frame and stops the output before it
+//	   sends the changes, commit starts a frame with them once they are there
+int libudmx_hold(libudmx_device *dev) {
+	if (!libudmx_is_connected(dev)) return UDMX_ERR_NOT_OPEN;
+	if (!(dev->caps & cap_HoldOutput)) return UDMX_ERR_UNSUPPORTED;
+	pthread_mutex_lock(&dev->lock);
+	dev->hold_pending = 1;
+	dev->commit_pending = 0;
+	pthread_mutex_unlock(&dev->lock);
+	return UDMX_OK;
+}
+
+// only submits, never connects: a lost device keeps the commit for the flush that reopens it
+int libudmx_commit(libudmx_device *dev) {
+
+	int rval;
+
+	if (!(dev->caps & cap_HoldOutput)) return UDMX_ERR_UNSUPPORTED;
+	pthread_mutex_lock(&dev->lock);
+	if (!dev->handle || dev->lost) {
+		pthread_mutex_unlock(&dev->lock);
+		return UDMX_ERR_NOT_OPEN;
+	}
+	dev->commit_pending = 1;
+	rval = send_changes(dev);
+	pthread_mutex_unlock(&dev->lock);
+	return rval;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_flush_urgent
+//
+// 	-> start sending urgent changes if the bus is free, never connects or waits.
+//	   if a transfer is on the bus, they are next
+int libudmx_flush_urgent(libudmx_device *dev) {
+
+	int w, rval = UDMX_OK;
+
+	pthread_mutex_lock(&dev->lock);
+	if (!dev->handle || dev->lost) {
+		rval = UDMX_ERR_NOT_OPEN;
+	} else if (!dev->in_flight && !dev->retry_wait) {
+		for (w = 0; w < PLAN_DIRTY_WORDS; w++) {
+			if (dev->dirty[w] & dev->urgent[w]) {
+				start_transfer(dev);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return rval;
+}
+
+int libudmx_submit(libudmx_device *dev, const libudmx_span *spans, int nspans) {
+	libudmx_apply(dev, spans, nspans);
+	return libudmx_flush(dev);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_drain
+//
+// 	-> wait until all changes are on the device, timeout in ms
+//	   failed transfers are retried as set by the policy
+int libudmx_drain(libudmx_device *dev, int timeout) {
+
+	int rval;
+
+	if ((rval = libudmx_flush(dev)) == UDMX_ERR_NOT_OPEN) return rval;
+	rval = UDMX_OK;
+	pthread_mutex_lock(&dev->lock);
+	while (rval == UDMX_OK && (dev->in_flight || dev->retry_wait || has_work(dev))) {
+		if (!dev->in_flight && !dev->retry_wait) start_transfer(dev);
+		if (wait_idle(dev, timeout) < 0) rval = UDMX_ERR_USB;
+		if (dev->lost || !dev->handle) rval = UDMX_ERR_NOT_OPEN;
+	}
+	dev->failed = 0;
+	pthread_mutex_unlock(&dev->lock);
+	return rval;
+}
+
+int libudmx_start_bootloader(libudmx_device *dev) {
+
+	unsigned char buffer[8];
+	int nBytes;
+
+	if (!libudmx_is_connected(dev)) return UDMX_ERR_NOT_OPEN;
+	nBytes = libusb_control_transfer(dev->handle, LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN,
+									 cmd_StartBootloader, 0, 0, buffer, sizeof(buffer), dev->policy.deadline);
+	if (nBytes < 0) {
+		set_usb_error(dev, nBytes);
+		return UDMX_ERR_USB;
+	}
+	return UDMX_OK;
+}
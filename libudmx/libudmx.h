@@ -0,0 +1,182 @@
+/*
+	libudmx.h
+
+	Host library for the [ a n y m a | usb-dmx-interface ]
+	shared by the command line tool and the Max and Pd externals
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+ */
+
+#ifndef __libudmx_h_included__
+#define __libudmx_h_included__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UDMX_CHANNELS			512		// number of channels in DMX-512
+#define UDMX_SERIAL_LEN			32		// max length of a serial number string
+
+// return values
+#define UDMX_OK					0
+#define UDMX_BUS_UNCHANGED		1		// libudmx_connect: no new devices since the last attempt
+#define UDMX_PENDING			2		// libudmx_connect_async: still looking
+#define UDMX_ERR_NOT_FOUND		-1		// no matching device on the bus
+#define UDMX_ERR_NOT_OPEN		-2		// no connection to a device
+#define UDMX_ERR_USB			-3		// transfer failed, see libudmx_strerror()
+#define UDMX_ERR_RANGE			-4		// channel out of range
+#define UDMX_ERR_UNSUPPORTED	-5		// the firmware doesn't know this request
+
+typedef struct _libudmx_device libudmx_device;
+
+// a run of consecutive channel values
+typedef struct _libudmx_span {
+	unsigned short			start;		// first channel [0 .. 511]
+	unsigned short			len;		// number of channels
+	const unsigned char		*data;		// len channel values
+} libudmx_span;
+
+// called from the library's event thread when a transfer has completed, after the
+// device is unlocked: it may apply, flush and ask for the state of the device, but
+// must not wait for transfers (libudmx_drain), connect, disconnect or free it,
+// those wait for the event thread. Keep it short, all devices share that thread.
+typedef void (*libudmx_done_fn)(void *ctx, int status, unsigned short start, unsigned short len);
+
+// what a device does when transfers fail
+typedef struct _libudmx_policy {
+	int						deadline;	// ms a transfer may take before it counts as failed
+	int						retries;	// failures in a row before the connection is reset
+	int						backoff;	// ms before the first resend, doubles with every failure
+} libudmx_policy;
+
+// counters since the handle was created
+typedef struct _libudmx_stats {
+	unsigned long			transfers;	// completed
+	unsigned long			failures;	// failed or missed the deadline
+	unsigned long			retries;
+	unsigned long			resets;		// connections given up after the last retry
+	unsigned long			superseded;	// changes replaced by a newer value before they were sent
+	unsigned long			refreshed;	// channels sent again by the background refresh
+} libudmx_stats;
+
+//----------------------------------------------------------------------------------------------------------------
+// device handle
+//
+// A handle keeps its universe while it is not connected, so values set before
+// the hardware shows up are sent with the next flush after connecting.
+// Only libudmx_new allocates memory, none of the other calls do.
+// libudmx_connect_async looks for the device on a thread of its own, connect,
+// bind and free wait for that attempt to finish, disconnect makes it close
+// whatever it finds instead.
+// Sending is asynchronous: flush starts a transfer and returns, changes made
+// while a transfer is on the bus go out as soon as it completes.
+// A failed transfer is resent with the values current at that time, after
+// the backoff of the policy. When the retries are used up the device counts
+// as disconnected and the next flush reopens it and sends the universe again,
+// up to the highest channel that was set: a device sends as many channels
+// per DMX frame as the highest one it was sent, more cost frame rate.
+// While nothing else is sent, the channels up to the highest one that was set
+// are sent again slice by slice in the background, so values lost on the way
+// don't stay wrong for long.
+libudmx_device *libudmx_new(const char *serial);			// serial NULL or "" binds to the first uDMX found
+void libudmx_free(libudmx_device *dev);
+int libudmx_bind(libudmx_device *dev, const char *serial);	// disconnects, next connect looks for this serial
+int libudmx_connect(libudmx_device *dev);					// UDMX_OK, UDMX_BUS_UNCHANGED or UDMX_ERR_NOT_FOUND
+int libudmx_connect_async(libudmx_device *dev);			// same, or UDMX_PENDING while it looks on a thread of its own
+void libudmx_disconnect(libudmx_device *dev);
+int libudmx_is_connected(const libudmx_device *dev);
+const char *libudmx_serial(const libudmx_device *dev);		// serial number of the connected device
+const char *libudmx_strerror(const libudmx_device *dev);	// description of the last error
+void libudmx_set_timeout(libudmx_device *dev, int timeout);	// transfer deadline in ms
+void libudmx_set_policy(libudmx_device *dev, const libudmx_policy *policy);	// NULL for the defaults
+void libudmx_get_policy(libudmx_device *dev, libudmx_policy *policy);
+void libudmx_get_stats(libudmx_device *dev, libudmx_stats *stats);
+void libudmx_set_refresh(libudmx_device *dev, int period);	// ms to refresh the channels that were set, 0 for never
+double libudmx_interval(libudmx_device *dev);				// measured ms between flushes the link sustains
+double libudmx_next_frame(libudmx_device *dev, double *period);	// ms until the next DMX frame starts, -1 if unknown
+double libudmx_next_flush(libudmx_device *dev, double not_before);	// ms until a flush lands just before a BREAK
+unsigned int libudmx_capabilities(const libudmx_device *dev);	// cap_* flags from uDMX_cmds.h, 0 for old firmware
+void libudmx_cost(libudmx_device *dev, double *overhead, double *per_byte);	// measured transfer cost in us
+void libudmx_set_callback(libudmx_device *dev, libudmx_done_fn fn, void *ctx);	// NULL to remove
+
+//----------------------------------------------------------------------------------------------------------------
+// universe
+const unsigned char *libudmx_universe(const libudmx_device *dev);
+int libudmx_apply(libudmx_device *dev, const libudmx_span *spans, int nspans);	// returns number of changed channels
+int libudmx_apply_frame(libudmx_device *dev, const unsigned char *frame);	// all UDMX_CHANNELS, returns number of changed channels
+void libudmx_mark_dirty(libudmx_device *dev, unsigned short start, unsigned short len);	// send even if unchanged, counts as set
+int libudmx_is_dirty(const libudmx_device *dev);
+void libudmx_set_priority(libudmx_device *dev, unsigned short start, unsigned short len, int urgent);	// urgent channels go first
+int libudmx_flush(libudmx_device *dev);						// start sending all changes since the last flush
+int libudmx_flush_urgent(libudmx_device *dev);				// same for urgent changes only, never connects
+int libudmx_submit(libudmx_device *dev, const libudmx_span *spans, int nspans);	// apply + flush
+int libudmx_drain(libudmx_device *dev, int timeout);		// wait until all changes are sent, timeout in ms
+int libudmx_hold(libudmx_device *dev);						// next flush stops the DMX output before sending
+int libudmx_commit(libudmx_device *dev);					// start the output again once the changes are there, never connects
+
+int libudmx_start_bootloader(libudmx_device *dev);
+int libudmx_enumerate(char (*serials)[UDMX_SERIAL_LEN], int max);	// serial numbers of all uDMX on the bus, returns count
+
+//----------------------------------------------------------------------------------------------------------------
+// diff kernel
+//
+// Compare frames of UDMX_CHANNELS values against the last ones. The bitmap
+// gets one bit per channel, bit (chan % 32) of word (chan / 32), and up to
+// max_spans runs of changed channels are returned, pointing into next.
+// If there are more runs, the last span is extended over the rest.
+int libudmx_diff(const unsigned char *last, const unsigned char *next, unsigned int *bitmap,
+				 libudmx_span *spans, int max_spans);	// spans may be NULL, returns number of spans
+int libudmx_diff_universes(const unsigned char *last, const unsigned char *next, int universes,
+						   unsigned int *bitmaps, libudmx_span *spans, int max_spans, int *nspans);
+
+//----------------------------------------------------------------------------------------------------------------
+// ramps
+//
+// Fades computed by the code that sends them: start a ramp once, then step
+// all ramps with every flush, they write their current values into the
+// universe. Times are in ms of the caller's clock. The caller owns the
+// ramps and does its own locking, nothing here allocates or blocks.
+typedef struct _libudmx_ramps {
+	unsigned int			active[UDMX_CHANNELS / 32];	// channels with a ramp, bits as in the diff bitmap
+	int						count;				// number of them
+	unsigned char			from[UDMX_CHANNELS];
+	unsigned char			to[UDMX_CHANNELS];
+	double					started[UDMX_CHANNELS];
+	double					length[UDMX_CHANNELS];
+} libudmx_ramps;
+
+void libudmx_ramps_init(libudmx_ramps *r);
+int libudmx_ramp(libudmx_ramps *r, const unsigned char *universe, unsigned short start, unsigned short len,
+				 const unsigned char *targets, double ms, double now);	// len targets, from the values in universe
+void libudmx_ramp_stop(libudmx_ramps *r, unsigned short start, unsigned short len);	// the channels keep their values
+int libudmx_ramps_active(const libudmx_ramps *r);			// number of channels with a ramp
+int libudmx_ramps_step(libudmx_ramps *r, double now, unsigned char *universe, unsigned int *mask);	// returns number of changed channels
+
+//----------------------------------------------------------------------------------------------------------------
+// device manager
+//
+// Maps logical universes to devices by serial number and keeps one sender
+// thread per device, so all devices are refreshed in parallel. Universes
+// start unmapped and get the devices nobody asked for, in serial number order.
+typedef struct _libudmx_manager libudmx_manager;
+
+libudmx_manager *libudmx_manager_new(int universes);
+void libudmx_manager_free(libudmx_manager *m);
+int libudmx_manager_universes(const libudmx_manager *m);
+int libudmx_manager_map(libudmx_manager *m, int universe, const char *serial);	// NULL or "" for automatic
+libudmx_device *libudmx_manager_device(libudmx_manager *m, int universe);
+int libudmx_manager_apply(libudmx_manager *m, int universe, const libudmx_span *spans, int nspans);
+int libudmx_manager_apply_frame(libudmx_manager *m, int universe, const unsigned char *frame);
+void libudmx_manager_commit(libudmx_manager *m);			// send all changes, on all devices at once
+void libudmx_manager_commit_sync(libudmx_manager *m);		// same, and start them on the same frame everywhere
+void libudmx_manager_drain(libudmx_manager *m);				// send all changes and wait until they are out
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,348 @@
+/*
+	manager.c
+
+	Device manager for libudmx: maps logical universes to uDMX devices by
+	serial number and runs one sender thread per device
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+
+	Every universe has its own device handle and worker thread. Values are
+	applied to the universes from any thread, libudmx_manager_commit then
+	wakes all workers at once. A worker finds its device if needed and starts
+	the transfer, so a device that is slow to find or has gone away never
+	holds up the others, and devices on different buses are busy at the
+	same time. Universes without a serial number get the devices nobody
+	asked for, in the order of their serial numbers.
+
+	libudmx_manager_commit_sync puts a barrier in between: every worker holds
+	the output of its device, uploads its changes and waits, the last one to
+	get there commits all devices at once, so they start the new look on the
+	same frame. It collects the held devices under the lock and commits them
+	after letting go of it; libudmx_commit only submits and never connects, so
+	the connection of every device is still only touched by its own worker.
+	Devices with older firmware just send their changes.
+
+	libudmx_manager_drain has every worker wait for its device to send all
+	changes, so the connections stay with the workers until the end.
+ */
+
+#include "libudmx.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define RECONNECT_INTERVAL		250		// ms between attempts to find a device
+#define MAX_DEVICES				64		// devices looked at for automatic mapping
+#define SYNC_TIMEOUT			250		// ms an upload may take before we commit anyway
+#define DRAIN_TIMEOUT			1000	// ms libudmx_manager_drain waits for a device
+
+typedef struct _worker {
+	libudmx_manager	*m;
+	libudmx_device	*dev;
+	pthread_t		thread;
+	pthread_cond_t	wake;
+	int				pending;			// commit requested
+	int				rebind;				// serial changed, bind before connecting
+	int				automatic;			// serial picked by the manager
+	int				assigned;			// automatic: the manager has picked a device
+	int				sync;				// synchronized commit requested
+	int				held;				// at the barrier with the output of the device held
+	int				drain;				// wait until the changes are sent, then tell the manager
+	char			serial[UDMX_SERIAL_LEN];	// may be "" for a device with old firmware
+} worker;
+
+struct _libudmx_manager {
+	int				universes;
+	worker			*workers;
+	pthread_mutex_t	lock;				// protects the worker fields above dev
+	int				quit;
+	int				sync_waiting;		// workers that haven't reached the barrier yet
+	int				sync_again;			// commit_sync was called while they were uploading
+	int				committing;			// the last one is committing the devices in release
+	libudmx_device	**release;			// held devices, one per universe
+	int				draining;			// workers that haven't drained their device yet
+	pthread_cond_t	drained;			// signalled when the last one has
+};
+
+static int compare_serials(const void *a, const void *b) {
+	return strcmp((const char *)a, (const char *)b);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// bind an automatic universe to the first device with a serial number nobody else uses
+static void assign_device(libudmx_manager *m, worker *w) {
+
+	char serials[MAX_DEVICES][UDMX_SERIAL_LEN];
+	int found, i, u, taken;
+
+	found = libudmx_enumerate(serials, MAX_DEVICES);
+	if (found > MAX_DEVICES) found = MAX_DEVICES;
+	if (found <= 0) return;
+	qsort(serials, found, UDMX_SERIAL_LEN, compare_serials);
+
+	pthread_mutex_lock(&m->lock);
+	for (i = 0; i < found; i++) {
+		if (!serials[i][0] && found > 1) continue;		// old firmware without serial, can't tell them apart
+		for (u = 0, taken = 0; u < m->universes && !taken; u++) {
+			worker *other = &m->workers[u];
+			taken = other != w && (!other->automatic || other->assigned) && strcmp(other->serial, serials[i]) == 0;
+		}
+		if (!taken) {
+			memcpy(w->serial, serials[i], UDMX_SERIAL_LEN);
+			w->assigned = 1;
+			w->rebind = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// synchronized commit, call with m->lock held
+static void arm_sync(libudmx_manager *m) {
+	int u;
+	for (u = 0; u < m->universes; u++) {
+		m->workers[u].sync = 1;
+		m->workers[u].pending = 1;
+		pthread_cond_signal(&m->workers[u].wake);
+	}
+	m->sync_waiting = m->universes;
+}
+
+// a worker is at the barrier, the last one lets all devices go
+static void sync_arrive(libudmx_manager *m, worker *w, int held) {
+
+	int u, n;
+
+	pthread_mutex_lock(&m->lock);
+	w->held = held;
+	if (--m->sync_waiting == 0) {
+		for (u = 0, n = 0; u < m->universes; u++) {
+			if (m->workers[u].held) m->release[n++] = m->workers[u].dev;
+			m->workers[u].held = 0;
+		}
+		m->committing = 1;						// nobody arms the next one meanwhile
+		pthread_mutex_unlock(&m->lock);
+		for (u = 0; u < n; u++)
+			libudmx_commit(m->release[u]);		// only submits, all within a few us
+		pthread_mutex_lock(&m->lock);
+		m->committing = 0;
+		if (m->sync_again) {
+			m->sync_again = 0;
+			arm_sync(m);
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// worker thread, one per universe
+static void *worker_loop(void *arg) {
+
+	worker *w = (worker *)arg;
+	libudmx_manager *m = w->m;
+	char serial[UDMX_SERIAL_LEN];
+	int rebind, bound, sync, held, drain;
+
+	pthread_mutex_lock(&m->lock);
+	for (;;) {
+		while (!w->pending && !m->quit)
+			pthread_cond_wait(&w->wake, &m->lock);
+		if (m->quit) break;
+		w->pending = 0;
+		if (w->automatic && !w->assigned) {
+			pthread_mutex_unlock(&m->lock);
+			assign_device(m, w);
+			pthread_mutex_lock(&m->lock);
+		}
+		rebind = w->rebind;
+		bound = !w->automatic || w->assigned;
+		sync = w->sync;
+		drain = w->drain;
+		w->rebind = w->sync = w->drain = 0;
+		memcpy(serial, w->serial, UDMX_SERIAL_LEN);
+		pthread_mutex_unlock(&m->lock);
+
+		if (rebind) libudmx_bind(w->dev, serial);		// disconnects, only the worker touches the connection
+		if (!libudmx_is_connected(w->dev)) {
+			if (!bound || libudmx_connect(w->dev) != UDMX_OK) {	// connect sends what was set
+				if (sync) sync_arrive(m, w, 0);					// don't hold up the others
+				pthread_mutex_lock(&m->lock);
+				if (drain && --m->draining == 0) pthread_cond_broadcast(&m->drained);	// nothing we could send
+				pthread_mutex_unlock(&m->lock);
+				usleep(RECONNECT_INTERVAL * 1000);
+				pthread_mutex_lock(&m->lock);
+				if (libudmx_is_dirty(w->dev)) w->pending = 1;	// try again, changes are kept until we find it
+				continue;
+			}
+		}
+		held = sync && libudmx_hold(w->dev) == UDMX_OK;
+		libudmx_flush(w->dev);
+		if (sync) {
+			libudmx_drain(w->dev, SYNC_TIMEOUT);		// the output is held while we upload
+			sync_arrive(m, w, held);
+		}
+		if (drain) libudmx_drain(w->dev, DRAIN_TIMEOUT);
+		pthread_mutex_lock(&m->lock);
+		if (drain && --m->draining == 0) pthread_cond_broadcast(&m->drained);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// manager
+libudmx_manager *libudmx_manager_new(int universes) {
+
+	libudmx_manager *m;
+	int u;
+
+	if (universes <= 0) return NULL;
+	if (!(m = (libudmx_manager *)calloc(1, sizeof(libudmx_manager)))) return NULL;
+	if (!(m->workers = (worker *)calloc(universes, sizeof(worker)))
+		|| !(m->release = (libudmx_device **)calloc(universes, sizeof(libudmx_device *)))) {
+		free(m->workers);
+		free(m);
+		return NULL;
+	}
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->drained, NULL);
+	m->universes = universes;
+
+	for (u = 0; u < universes; u++) {
+		worker *w = &m->workers[u];
+		w->m = m;
+		w->automatic = 1;
+		pthread_cond_init(&w->wake, NULL);
+		if (!(w->dev = libudmx_new(NULL)) || pthread_create(&w->thread, NULL, worker_loop, w) != 0) {
+			if (w->dev) libudmx_free(w->dev);
+			pthread_cond_destroy(&w->wake);
+			m->universes = u;
+			libudmx_manager_free(m);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+void libudmx_manager_free(libudmx_manager *m) {
+
+	int u;
+
+	if (!m) return;
+	pthread_mutex_lock(&m->lock);
+	m->quit = 1;
+	for (u = 0; u < m->universes; u++)
+		pthread_cond_signal(&m->workers[u].wake);
+	pthread_mutex_unlock(&m->lock);
+
+	for (u = 0; u < m->universes; u++) {
+		pthread_join(m->workers[u].thread, NULL);
+		libudmx_free(m->workers[u].dev);
+		pthread_cond_destroy(&m->workers[u].wake);
+	}
+	pthread_cond_destroy(&m->drained);
+	pthread_mutex_destroy(&m->lock);
+	free(m->release);
+	free(m->workers);
+	free(m);
+}
+
+int libudmx_manager_universes(const libudmx_manager *m) {
+	return m->universes;
+}
+
+int libudmx_manager_map(libudmx_manager *m, int universe, const char *serial) {
+
+	worker *w;
+
+	if (universe < 0 || universe >= m->universes) return UDMX_ERR_RANGE;
+	w = &m->workers[universe];
+
+	pthread_mutex_lock(&m->lock);
+	w->automatic = !serial || !serial[0];
+	w->assigned = 0;
+	if (w->automatic) w->serial[0] = 0;
+	else {
+		strncpy(w->serial, serial, UDMX_SERIAL_LEN - 1);
+		w->serial[UDMX_SERIAL_LEN - 1] = 0;
+	}
+	w->rebind = 1;
+	w->pending = 1;				// the worker binds and connects
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&m->lock);
+	return UDMX_OK;
+}
+
+libudmx_device *libudmx_manager_device(libudmx_manager *m, int universe) {
+	if (universe < 0 || universe >= m->universes) return NULL;
+	return m->workers[universe].dev;
+}
+
+int libudmx_manager_apply(libudmx_manager *m, int universe, const libudmx_span *spans, int nspans) {
+	if (universe < 0 || universe >= m->universes) return UDMX_ERR_RANGE;
+	return libudmx_apply(m->workers[universe].dev, spans, nspans);
+}
+
+int libudmx_manager_apply_frame(libudmx_manager *m, int universe, const unsigned char *frame) {
+	if (universe < 0 || universe >= m->universes) return UDMX_ERR_RANGE;
+	return libudmx_apply_frame(m->workers[universe].dev, frame);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_manager_commit
+//
+// 	-> wake the workers of all universes with changes, never blocks on USB
+void libudmx_manager_commit(libudmx_manager *m) {
+
+	int u;
+
+	pthread_mutex_lock(&m->lock);
+	for (u = 0; u < m->universes; u++) {
+		worker *w = &m->workers[u];
+		if (libudmx_is_dirty(w->dev) || !libudmx_is_connected(w->dev)) {
+			w->pending = 1;
+			pthread_cond_signal(&w->wake);
+		}
+	}
+	pthread_mutex_unlock(&m->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_manager_commit_sync
+//
+// 	-> send all changes and switch all devices over to them on the same frame
+void libudmx_manager_commit_sync(libudmx_manager *m) {
+	pthread_mutex_lock(&m->lock);
+	if (m->sync_waiting || m->committing) m->sync_again = 1;	// still busy with the last one, go again when it's out
+	else arm_sync(m);
+	pthread_mutex_unlock(&m->lock);
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_manager_drain
+//
+// 	-> send all changes and wait until every device has them, or has given up
+void libudmx_manager_drain(libudmx_manager *m) {
+
+	int u;
+
+	pthread_mutex_lock(&m->lock);
+	while (m->draining)							// somebody else is waiting, let them finish
+		pthread_cond_wait(&m->drained, &m->lock);
+	m->draining = m->universes;
+	for (u = 0; u < m->universes; u++) {
+		m->workers[u].drain = 1;
+		m->workers[u].pending = 1;
+		pthread_cond_signal(&m->workers[u].wake);
+	}
+	while (m->draining)
+		pthread_cond_wait(&m->drained, &m->lock);
+	pthread_mutex_unlock(&m->lock);
+}
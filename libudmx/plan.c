@@ -0,0 +1,195 @@
+/*
+	plan.c
+
+	Transfer planner for libudmx
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+
+	The changed channels form runs of consecutive channels. Each run can go
+	out on its own (single, range or fill), several neighbouring runs can
+	share one range that also resends the unchanged channels in between, or
+	runs can be collected into one sparse transfer. A dynamic program over
+	the runs finds the cheapest combination for the current cost model.
+	Only the first transfer of the plan is returned: everything else stays
+	dirty and is planned again, together with newer changes, when it is done.
+ */
+
+#include "plan.h"
+#include "../common/uDMX_cmds.h"
+
+#define DEFAULT_OVERHEAD		1000.	// us per control transfer on a low speed device
+#define DEFAULT_PER_BYTE		125.	// us per byte, one 8 byte packet per frame
+#define COST_SMOOTHING			8		// weight of the old estimate when measuring
+
+#define MAX_RUNS				(UDMX_CHANNELS / 2)
+
+//----------------------------------------------------------------------------------------------------------------
+// dirty bitmap
+void plan_mark(unsigned int *dirty, unsigned short start, unsigned short len) {
+	unsigned short chan;
+	for (chan = start; chan < start + len && chan < UDMX_CHANNELS; chan++)
+		dirty[chan / 32] |= 1u << (chan % 32);
+}
+
+void plan_clear(unsigned int *dirty, const plan_transfer *t) {
+	unsigned short i;
+	if (t->kind == PLAN_SPARSE) {
+		for (i = 0; i < t->count; i++)
+			dirty[t->channels[i] / 32] &= ~(1u << (t->channels[i] % 32));
+	} else {
+		for (i = t->start; i < t->start + t->len; i++)
+			dirty[i / 32] &= ~(1u << (i % 32));
+	}
+}
+
+int plan_is_dirty(const unsigned int *dirty) {
+	int w;
+	for (w = 0; w < PLAN_DIRTY_WORDS; w++)
+		if (dirty[w]) return 1;
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// cost model
+void plan_cost_init(plan_cost *cost) {
+	cost->overhead = DEFAULT_OVERHEAD;
+	cost->per_byte = DEFAULT_PER_BYTE;
+}
+
+int plan_bytes(const plan_transfer *t) {
+	switch (t->kind) {
+		case PLAN_SINGLE:	return 0;
+		case PLAN_FILL:		return 1;
+		case PLAN_SPARSE:	return 3 * t->count;
+		default:			return t->len;
+	}
+}
+
+void plan_cost_update(plan_cost *cost, const plan_transfer *t, double usec) {
+
+	int bytes = plan_bytes(t);
+
+	if (bytes < 8) {		// (almost) no data stage: this is the overhead
+		cost->overhead += (usec - bytes * cost->per_byte - cost->overhead) / COST_SMOOTHING;
+		if (cost->overhead < 1.) cost->overhead = 1.;
+	} else {
+		double per_byte = (usec - cost->overhead) / bytes;
+		if (per_byte > 0.) cost->per_byte += (per_byte - cost->per_byte) / COST_SMOOTHING;
+		if (cost->per_byte < .01) cost->per_byte = .01;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// cheapest transfer for runs i..j, all of them in one go
+static double segment_cost(const unsigned short *run_start, const unsigned short *run_end, const unsigned char *uniform,
+						   int i, int j, unsigned int caps, const plan_cost *cost, int *kind) {
+
+	unsigned short len = run_end[j] - run_start[i] + 1;
+	double best = cost->overhead + cost->per_byte * len;
+
+	*kind = PLAN_RANGE;
+	if (i == j && len == 1) {
+		*kind = PLAN_SINGLE;
+		return cost->overhead;
+	}
+	if (i == j && uniform[i] && (caps & cap_FillChannelRange) && cost->overhead + cost->per_byte < best) {
+		*kind = PLAN_FILL;
+		best = cost->overhead + cost->per_byte;
+	}
+	return best;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// plan_next
+int plan_next(const unsigned int *dirty, const unsigned char *universe, unsigned int caps,
+			  const plan_cost *cost, plan_transfer *t) {
+
+	unsigned short run_start[MAX_RUNS], run_end[MAX_RUNS];
+	unsigned char uniform[MAX_RUNS];
+	double best[MAX_RUNS + 1][2];		// cheapest plan for the first j runs, [1]: with a sparse transfer
+	short from[MAX_RUNS + 1][2];		// where the last segment starts, -1 for sparse
+	unsigned char from_state[MAX_RUNS + 1];
+	unsigned short sparse[UDMX_CHANNELS];
+	int nruns = 0, nsparse, w, i, j, kind, state;
+	unsigned short chan;
+	unsigned int bits;
+
+	// find runs of dirty channels
+	for (w = 0; w < PLAN_DIRTY_WORDS; w++) {
+		bits = dirty[w];
+		while (bits) {
+			chan = w * 32 + __builtin_ctz(bits);
+			bits &= bits - 1;
+			if (nruns && run_end[nruns-1] + 1 == chan) {
+				run_end[nruns-1] = chan;
+				if (universe[chan] != universe[run_start[nruns-1]]) uniform[nruns-1] = 0;
+			} else {
+				run_start[nruns] = run_end[nruns] = chan;
+				uniform[nruns] = 1;
+				nruns++;
+			}
+		}
+	}
+	if (!nruns) return 0;
+
+	// dynamic program over the runs
+	best[0][0] = 0.;
+	best[0][1] = 1e30;
+	for (j = 0; j < nruns; j++) {
+		double sparse_cost = 3. * cost->per_byte * (run_end[j] - run_start[j] + 1);
+
+		best[j+1][0] = best[j+1][1] = 1e30;
+		for (i = 0; i <= j; i++) {
+			double c = segment_cost(run_start, run_end, uniform, i, j, caps, cost, &kind);
+			if (best[i][0] + c < best[j+1][0]) { best[j+1][0] = best[i][0] + c; from[j+1][0] = i; }
+			if (best[i][1] + c < best[j+1][1]) { best[j+1][1] = best[i][1] + c; from[j+1][1] = i; }
+		}
+		if (caps & cap_SetChannelSparse) {
+			from_state[j+1] = 1;
+			if (best[j][0] + cost->overhead + sparse_cost < best[j+1][1]) {
+				best[j+1][1] = best[j][0] + cost->overhead + sparse_cost;
+				from[j+1][1] = -1;
+				from_state[j+1] = 0;
+			}
+			if (best[j][1] + sparse_cost < best[j+1][1]) {
+				best[j+1][1] = best[j][1] + sparse_cost;
+				from[j+1][1] = -1;
+				from_state[j+1] = 1;
+			}
+		}
+	}
+
+	// walk back through the plan, collecting the sparse channels from the top
+	state = best[nruns][1] < best[nruns][0];
+	t->kind = 0;
+	t->count = 0;
+	nsparse = 0;
+	for (j = nruns; j > 0; ) {
+		if (from[j][state] < 0) {			// run j-1 is in the sparse transfer
+			for (chan = run_end[j-1] + 1; chan-- > run_start[j-1]; )
+				sparse[nsparse++] = chan;
+			state = from_state[j];
+			j--;
+		} else {							// runs i..j-1 are one segment, the last one we see is the lowest
+			i = from[j][state];
+			segment_cost(run_start, run_end, uniform, i, j - 1, caps, cost, &kind);
+			t->kind = kind;
+			t->start = run_start[i];
+			t->len = run_end[j-1] - run_start[i] + 1;
+			j = i;
+		}
+	}
+	if (nsparse) {							// send the lowest ones, the rest goes next time
+		t->kind = PLAN_SPARSE;
+		t->count = nsparse < PLAN_SPARSE_MAX ? nsparse : PLAN_SPARSE_MAX;
+		for (i = 0; i < t->count; i++)
+			t->channels[i] = sparse[nsparse - 1 - i];
+		t->start = t->channels[0];
+		t->len = t->channels[t->count - 1] - t->start + 1;
+	}
+	return 1;
+}
@@ -0,0 +1,58 @@
+/*
+	plan.h
+
+	Transfer planner for libudmx: picks the cheapest transfer for a set of
+	changed channels, given what the device supports and what a transfer costs
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+ */
+
+#ifndef __udmx_plan_h_included__
+#define __udmx_plan_h_included__
+
+#include "libudmx.h"
+
+#define PLAN_DIRTY_WORDS		(UDMX_CHANNELS / 32)
+#define PLAN_SPARSE_MAX			128		// channels per cmd_SetChannelSparse, keeps the buffer small
+
+// kinds of transfer
+#define PLAN_SINGLE				1		// cmd_SetSingleChannel
+#define PLAN_RANGE				2		// cmd_SetChannelRange
+#define PLAN_FILL				3		// cmd_FillChannelRange
+#define PLAN_SPARSE				4		// cmd_SetChannelSparse
+#define PLAN_HOLD				5		// cmd_HoldOutput 1, no channels, set by libudmx
+#define PLAN_COMMIT				6		// cmd_HoldOutput 0, same
+
+// cost of a transfer in microseconds: overhead + per_byte * bytes in the data stage
+typedef struct _plan_cost {
+	double			overhead;
+	double			per_byte;
+} plan_cost;
+
+typedef struct _plan_transfer {
+	int				kind;
+	unsigned short	start, len;					// channels covered, start and len of the whole span for PLAN_SPARSE
+	unsigned short	count;						// PLAN_SPARSE: number of channels
+	unsigned short	channels[PLAN_SPARSE_MAX];	// PLAN_SPARSE: the channels
+} plan_transfer;
+
+// dirty bitmap, bit (chan % 32) of word (chan / 32)
+void plan_mark(unsigned int *dirty, unsigned short start, unsigned short len);
+void plan_clear(unsigned int *dirty, const plan_transfer *t);
+int plan_is_dirty(const unsigned int *dirty);
+
+// cost model, updated with the measured duration of every transfer
+void plan_cost_init(plan_cost *cost);
+int plan_bytes(const plan_transfer *t);
+void plan_cost_update(plan_cost *cost, const plan_transfer *t, double usec);
+
+// find the cheapest set of transfers for all dirty channels and return the first
+// one in t. returns 0 if nothing is dirty. caps are cap_* flags of the device
+int plan_next(const unsigned int *dirty, const unsigned char *universe, unsigned int caps,
+			  const plan_cost *cost, plan_transfer *t);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+	ramp.c
+
+	Ramp engine for libudmx: fades channels to a target over a time, the
+	values are computed where they are sent instead of arriving one message
+	per step
+
+	Authors:	Max & Michael Egger
+	Copyright:	2006-2026 [ a n y m a ]
+	Website:	www.anyma.ch
+
+	License:	GNU GPL 2.0 www.gnu.org
+
+	Every channel has at most one ramp, a new one starts from the value the
+	channel has at that time. The caller keeps the ramps next to its universe
+	and steps them once per flush, with the time in ms from any clock, as
+	long as it uses the same one throughout. Stepping only looks at the
+	channels with a ramp, a word of the bitmap at a time.
+ */
+
+#include "libudmx.h"
+
+#include <string.h>
+
+#define RAMP_WORDS			(UDMX_CHANNELS / 32)
+
+void libudmx_ramps_init(libudmx_ramps *r) {
+	memset(r, 0, sizeof(libudmx_ramps));
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_ramp
+//
+// 	-> start ramps on len channels from start, from their values in universe to targets in ms
+int libudmx_ramp(libudmx_ramps *r, const unsigned char *universe, unsigned short start, unsigned short len,
+				 const unsigned char *targets, double ms, double now) {
+
+	unsigned short chan;
+	unsigned int bit;
+
+	if (start >= UDMX_CHANNELS) return UDMX_ERR_RANGE;
+	if (len > UDMX_CHANNELS - start) len = UDMX_CHANNELS - start;
+	if (ms < 0.) ms = 0.;
+
+	for (chan = start; chan < start + len; chan++, targets++) {
+		bit = 1u << (chan % 32);
+		if (!(r->active[chan / 32] & bit)) {
+			r->active[chan / 32] |= bit;
+			r->count++;
+		}
+		r->from[chan] = universe[chan];
+		r->to[chan] = *targets;
+		r->started[chan] = now;
+		r->length[chan] = ms;				// 0 jumps with the next step
+	}
+	return UDMX_OK;
+}
+
+void libudmx_ramp_stop(libudmx_ramps *r, unsigned short start, unsigned short len) {
+
+	unsigned short chan;
+	unsigned int bit;
+
+	if (!r->count || start >= UDMX_CHANNELS) return;
+	if (len > UDMX_CHANNELS - start) len = UDMX_CHANNELS - start;
+	for (chan = start; chan < start + len; chan++) {
+		bit = 1u << (chan % 32);
+		if (r->active[chan / 32] & bit) {
+			r->active[chan / 32] &= ~bit;
+			r->count--;
+		}
+	}
+}
+
+int libudmx_ramps_active(const libudmx_ramps *r) {
+	return r->count;
+}
+
+//----------------------------------------------------------------------------------------------------------------
+// libudmx_ramps_step
+//
+// 	-> write the values of all ramps at now into universe and set the bits of the ones that
+//	   changed in mask, if not NULL. ramps that have arrived are done
+int libudmx_ramps_step(libudmx_ramps *r, double now, unsigned char *universe, unsigned int *mask) {
+
+	int w, changed = 0;
+	unsigned int bits;
+	unsigned short chan;
+	unsigned char val;
+	double t;
+
+	for (w = 0; w < RAMP_WORDS && r->count; w++) {
+		for (bits = r->active[w]; bits; bits &= bits - 1) {
+			chan = w * 32 + __builtin_ctz(bits);
+			t = now - r->started[chan];
+			if (t >= r->length[chan]) {
+				val = r->to[chan];
+				r->active[w] &= ~(1u << (chan % 32));
+				r->count--;
+			} else {
+				val = r->from[chan] + ((int)r->to[chan] - r->from[chan]) * (t > 0. ? t : 0.) / r->length[chan] + .5;
+			}
+			if (universe[chan] != val) {
+				universe[chan] = val;
+				if (mask) mask[w] |= 1u << (chan % 32);
+				changed++;
+			}
+		}
+	}
+	return changed;
+}
@@ -9,68 +9,158 @@
 	
 	License:	GNU GPL 2.0 www.gnu.org
 	
-	Version:	2015-11-09
+	Version:	2026-10-19
+
+	All [udmx] objects bound to the same device share one port: its universe,
+	its sender thread and its connection. Ports live in a process-wide
+	registry, counted by the objects that use them, so objects at different
+	start addresses write into one universe and their changes go out together.
+
+	[udmx~ channels start] is the signal rate version, in the same bundle so
+	it shares the ports. Install udmx-objectmappings.txt into the init folder
+	of the package so Max finds it. Every signal inlet drives one channel,
+	0..1 as floats in [udmx]. The DSP thread takes one value per channel
+	and DMX frame, sample accurate, and hands them to the sender thread
+	without taking any lock the sender may hold.
+
+	"ramp channel target ms" fades inside the object: the sender thread
+	computes the values of all fades with every flush, so a fade costs one
+	message instead of one per step. Setting a channel by hand ends its fade.
  */
 
 
 #include "ext.h"  		// you must include this - it contains the external object's link to available Max functions
 #include "ext_common.h"
+#include "ext_systhread.h"
+#include "z_dsp.h"
+#include "jit.common.h"
 
 
-#include "../common/udmx_cmds.h"
+#include "../libudmx/libudmx.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include </usr/local/include/usb.h>    /* this is libusb, see http://libusb.sourceforge.net/ */
+#include <stdatomic.h>
+
+#define SPEED_LIMIT_MAX			100		//  ceiling of the adaptive speed limit in ms
+#define RECONNECT_INTERVAL		250		//  ms between attempts to find the hardware
+#define DIRTY_WORDS				(UDMX_CHANNELS / 32)
+#define DIFF_MIN_LEN			32		//  lists at least this long go through the diff kernel
+#define FRAME_US_DEFAULT		22754	//  us per DMX frame of a full universe, until the sender knows better
+#define FRAME_US_MIN			1000	//  udmx~ takes values at most this often
 
-#define USBDEV_SHARED_VENDOR    	0x16C0  /* VOTI */
-#define USBDEV_SHARED_PRODUCT   	0x05DC  /* Obdev's free shared PID for Vendor-Type devices*/
-#define USBDEV_SHARED_PRODUCT_HID   0x05DF  /* Obdev's free shared PID for HID devices*/
-#define USBDEV_SHARED_PRODUCT_MIDI   0x05E4  /* Obdev's free shared PID for MIDI devices*/
+// requests from the Max thread to the sender thread
+enum {
+    REQ_OPEN	= 1,
+    REQ_CLOSE	= 2,
+    REQ_QUIT	= 8
+};
 
-#define SPEED_LIMIT				10 		//  default transmission speed limit in ms
+struct _udmx;
+
+typedef struct _udmx_port			// one device, shared by all objects bound to it
+{
+    struct _udmx_port *next;		// in the registry
+    t_symbol		*key;			// serial number, "" for the first uDMX found
+    int				refcount;		// objects using the port, protected by registry_lock
+    struct _udmx	*members;		// same, to report connection changes
+    libudmx_device	*dev;			// handle to the udmx converter, the sender thread connects and flushes
+    t_uint8			debug_flag;
+    t_uint16		speedlim_min;	// floor and ceiling of the speed limit in ms,
+    t_uint16		speedlim_max;	// in between it follows what the link sustains
+    
+    // the Max thread writes values into dmx_buffer and then sets their bits in dirty,
+    // the sender thread takes the bits and sends what is in dmx_buffer at that time.
+    // a value changed again before it was sent simply goes out in its latest state.
+    t_uint8			dmx_buffer[UDMX_CHANNELS];
+    atomic_uint		dirty[DIRTY_WORDS];
+    unsigned int	urgent[DIRTY_WORDS];	// channels that skip the sender thread and the speed limit
+    atomic_int		requests;		// REQ_* flags
+    atomic_int		found;			// result of the last connection attempt of the sender thread
+    atomic_int		reported;		// the sender thread has made at least one
+    atomic_int		frame_us;		// us between flushes, udmx~ takes values at this rate
+    char			serial[UDMX_SERIAL_LEN];	// serial number, written by the sender thread before found
+    t_systhread		thread;
+    t_systhread_mutex wake_lock;
+    t_systhread_cond wake_cond;
+    atomic_int		wake_pending;
+    
+    // fades, stepped by the sender thread with every flush. the Max thread starts and
+    // stops them under ramp_lock, ramping tells it whether there are any without the lock
+    libudmx_ramps	ramps;
+    t_systhread_mutex ramp_lock;
+    atomic_int		ramping;
+} t_udmx_port;
 
 typedef struct _udmx				// defines our object's internal variables for each instance in a patch
 {
     t_object 		p_ob;			// object header - ALL objects MUST begin with this...
     t_uint16 		channel;		// int value - received from the right inlet and stored internally for each object instance
-    usb_dev_handle	*dev_handle;	// handle to the udmx converter
-    t_uint8			debug_flag;
-    void			*m_clock;		// handle to our clock
-    void *m_qelem;
-    t_uint8			clock_running;	// is our clock running?
-    t_uint16		speedlim;
+    t_udmx_port		*port;			// the device we write to
+    struct _udmx	*next_member;	// in port->members
+    void *m_qelem;					// reports connection changes on the main thread
+    t_uint8			connected;		// connection status as last reported on our outlet
     void 			*statusOutlet;		// our status outlet
     void			*msgOutlet;		//
-    t_uint8			dmx_buffer[512];
-    t_int8			usb_devices_seen;
-    t_uint16		channel_changed_min,channel_changed_max;
-    char			serial_number[32];
-    char			bind_to[32];
     t_uint8         correct_adressing;
+    long			plane;			// plane of a jit_matrix to read, -1 for all of them, interleaved
 } t_udmx;
 
+typedef struct _udmx_tilde			// [udmx~], one signal inlet per channel
+{
+    t_pxobject		p_ob;			// MSP object header
+    t_udmx_port		*port;
+    t_uint16		start;			// channel of the first inlet
+    t_uint16		channels;		// number of inlets
+    double			samplerate;
+    double			countdown;		// samples until we take the next values
+} t_udmx_tilde;
+
 static t_class *udmx_class; // global pointer to the object class - so max can reference the object
+static t_class *udmx_tilde_class;
+
+static t_systhread_mutex registry_lock;	// protects the registry, refcounts and member lists
+static t_udmx_port *registry = NULL;
 
 // these are prototypes for the methods that are defined below
 void udmx_int(t_udmx *x, t_int16 n);
 void udmx_float(t_udmx *x, double f);
-void udmx_speedlim(t_udmx *x, t_uint16 n);
+void udmx_speedlim(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_policy(t_udmx *x, t_symbol *s, short ac, t_atom *av);
 void udmx_in1(t_udmx *x, t_int16 n);
 void udmx_list(t_udmx *x, t_symbol *s, short ac, t_atom *av);
 void udmx_open(t_udmx *x);
 void udmx_close(t_udmx *x);
 void udmx_bind(t_udmx *x, t_symbol *s);
-void udmx_tick(t_udmx *x);
+void udmx_status(t_udmx *x);
 void udmx_getSerial(t_udmx *x);
 void udmx_blackout(t_udmx *x);
 void udmx_assist(t_udmx *x, void *b, t_uint16 m, t_uint16 a, char *s);
 void *udmx_new(t_symbol *s, long argc, t_atom *argv);
 void udmx_free(t_udmx *x);
-static int  usbGetStringAscii(usb_dev_handle *dev, t_uint16 index, t_uint16 langid, char *buf, t_uint16 buflen);
-void find_device(t_udmx *x);
-void udmx_send_range(t_udmx *x, t_uint16 from, t_uint16 to);
-void udmx_send_single(t_udmx *x, t_uint16 chann);
+void udmx_set(t_udmx *x, t_uint16 from, t_uint16 len, t_uint8 *values);
+void udmx_set_pairs(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_changed(t_udmx_port *p, const unsigned int *mask);
+void udmx_jit_matrix(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_plane(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_ramp(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_ramplist(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_ramp_start(t_udmx_port *p, t_uint16 from, t_uint16 len, t_uint8 *targets, double ms);
+void udmx_ramp_stop(t_udmx_port *p, t_uint16 from, t_uint16 len);
+void udmx_send_urgent(t_udmx_port *p, const unsigned int *mask);
+void udmx_priority(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_wake(t_udmx_port *p, int requests);
+void *udmx_sender(t_udmx_port *p);
+void udmx_pause(t_udmx_port *p, double ms);
+void udmx_report(t_udmx_port *p);
+t_udmx_port *udmx_port_acquire(t_udmx *x, t_symbol *key);
+void udmx_port_release(t_udmx_port *p, t_udmx *x);
+void udmx_wake_nowait(t_udmx_port *p);
+void *udmx_tilde_new(t_symbol *s, long argc, t_atom *argv);
+void udmx_tilde_free(t_udmx_tilde *x);
+void udmx_tilde_dsp64(t_udmx_tilde *x, t_object *dsp64, short *count, double samplerate, long maxvectorsize, long flags);
+void udmx_tilde_perform64(t_udmx_tilde *x, t_object *dsp64, double **ins, long numins, double **outs, long numouts, long sampleframes, long flags, void *userparam);
+void udmx_tilde_assist(t_udmx_tilde *x, void *b, long m, long a, char *s);
 
 void udmx_message(t_udmx *x,t_symbol *message) {
     //outlet_anything(x->msgOutlet,gensym("set"),1,&out);
@@ -97,30 +187,8 @@ void udmx_int(t_udmx *x, t_int16 n){
     if (n > 255) n=255;
     if (n < 0) n=0;
     
-    
-    if (x->dmx_buffer[x->channel] == n) return; // do nothing if value did not change
-    
-    x->dmx_buffer[x->channel] = n;
-    
-    if (x->clock_running) { // we're over the speed limit, track changes for later
-        if (x->channel > x->channel_changed_max) x->channel_changed_max = x->channel;
-        if (x->channel < x->channel_changed_min)  x->channel_changed_min = x->channel;
-        
-    } else {
-        
-        udmx_send_single(x,x->channel);
-        
-        if (x->speedlim) {
-            // start clock
-#ifdef PUREDATA   	// compiling for PUREDATA
-            clock_delay(x->m_clock,x->speedlim);
-#else				// compiling for MaxMSP
-            clock_fdelay(x->m_clock,x->speedlim);
-#endif				// Max/PD switch
-            x->clock_running  = 1;
-        }
-    }
-    
+    t_uint8 val = n;
+    udmx_set(x, x->channel, 1, &val);
 }
 
 //----------------------------------------------------------------------------------------------------------------
@@ -135,32 +203,9 @@ void udmx_float(t_udmx *x, double f){
     if (f < 0) f=0;
 
     f *= 255.;
-    unsigned char n = f;
-    
-    
-    if (x->dmx_buffer[x->channel] == n) return; // do nothing if value did not change
-    
-    x->dmx_buffer[x->channel] = n;
-    
-    if (x->clock_running) { // we're over the speed limit, track changes for later
-        if (x->channel > x->channel_changed_max) x->channel_changed_max = x->channel;
-        if (x->channel < x->channel_changed_min)  x->channel_changed_min = x->channel;
-        
-    } else {
-        
-        udmx_send_single(x,x->channel);
-        
-        if (x->speedlim) {
-            // start clock
-#ifdef PUREDATA   	// compiling for PUREDATA
-            clock_delay(x->m_clock,x->speedlim);
-#else				// compiling for MaxMSP
-            clock_fdelay(x->m_clock,x->speedlim);
-#endif				// Max/PD switch
-            x->clock_running  = 1;
-        }
-    }
+    t_uint8 n = f;
     
+    udmx_set(x, x->channel, 1, &n);
 }
 
 
@@ -171,9 +216,10 @@ void udmx_float(t_udmx *x, double f){
 //----------------------------------------------------------------------------------------------------------------
 void udmx_list(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
     
-    t_uint16 i,chan,val,change_min,change_max;
-    change_min = 512;
-    change_max = 0;
+    t_uint16 i,val;
+    t_uint8 values[UDMX_CHANNELS];     // no allocation per message
+    
+    if (ac > UDMX_CHANNELS - x->channel) ac = UDMX_CHANNELS - x->channel;
     
     for(i=0; i<ac; ++i,av++) {
         
@@ -192,158 +238,484 @@ void udmx_list(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
         else val = 0;
 #endif				// Max/PD switch
         
-        
-        chan = x->channel+i;
-        
-        if (val != x->dmx_buffer[chan]) {
-            x->dmx_buffer[chan] = val;
-            if (change_min > chan) change_min = chan;
-            if (change_max < chan) change_max = chan;
-        }
+        values[i] = val;
     }
     
-    if (change_min > change_max) return;	// if there are no changes do nothing
+    udmx_set(x, x->channel, ac, values);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_set
+//
+//	-> update the buffer and wake the sender thread, never blocks
+//----------------------------------------------------------------------------------------------------------------
+void udmx_set(t_udmx *x, t_uint16 from, t_uint16 len, t_uint8 *values) {
+    
+    t_udmx_port *p = x->port;
+    unsigned int mask[DIRTY_WORDS];
+    t_uint16 i, chan;
     
-    if (x->clock_running) { 				// we're over the speed limit, track changes for later
-        if (change_min < x->channel_changed_min)  	x->channel_changed_min = change_min;
-        if (change_max > x->channel_changed_max) 	x->channel_changed_max = change_max;
+    if (from >= UDMX_CHANNELS) return;
+    if (len > UDMX_CHANNELS - from) len = UDMX_CHANNELS - from;
+    udmx_ramp_stop(p, from, len);			// a value set by hand ends the fade
+    
+    if (len >= DIFF_MIN_LEN) {				// long lists: let the diff kernel find the changes
+        t_uint8 frame[UDMX_CHANNELS];
         
+        memcpy(frame, p->dmx_buffer, UDMX_CHANNELS);
+        memcpy(frame + from, values, len);
+        libudmx_diff(p->dmx_buffer, frame, mask, NULL, 0);
+        memcpy(p->dmx_buffer + from, values, len);
     } else {
-        if (change_max - change_min) udmx_send_range(x,change_min,change_max);
-        else udmx_send_single (x,change_min);
-        
-        if (x->speedlim) {
-            // start clock -> prevent sending over speed limit
-#ifdef PUREDATA   	// compiling for PUREDATA
-            clock_delay(x->m_clock,x->speedlim);
-#else				// compiling for MaxMSP
-            clock_fdelay(x->m_clock,x->speedlim);
-#endif				// Max/PD switch			x->clock_running  = 1;
+        memset(mask, 0, sizeof(mask));
+        for (i = 0, chan = from; i < len; i++, chan++) {
+            if (p->dmx_buffer[chan] != values[i]) {
+                p->dmx_buffer[chan] = values[i];
+                mask[chan / 32] |= 1u << (chan % 32);
+            }
         }
-        
     }
+    udmx_changed(p, mask);
 }
 //----------------------------------------------------------------------------------------------------------------
-// udmx_send_single
+// udmx_set_pairs: 	"set channel value channel value ..."
 //
-//	-> change only one channel
+// 				update scattered channels with one message, they go out with one flush
 //----------------------------------------------------------------------------------------------------------------
-void udmx_send_single(t_udmx *x, t_uint16 chann) {
+void udmx_set_pairs(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
     
+    t_udmx_port *p = x->port;
+    unsigned int mask[DIRTY_WORDS];
+    long chan, val;
     
-    t_uint16 nBytes;
+    memset(mask, 0, sizeof(mask));
+    for (; ac >= 2; ac -= 2, av += 2) {
+        chan = atom_getlong(av);
+        if (x->correct_adressing) chan--;
+        if (chan < 0 || chan >= UDMX_CHANNELS) continue;
+        if (atom_gettype(av + 1) == A_FLOAT) val = atom_getfloat(av + 1) * 255.;	// floats are 0..1 as in the left inlet
+        else val = atom_getlong(av + 1);
+        val = MIN(MAX(val, 0), 255);
+        udmx_ramp_stop(p, chan, 1);
+        if (p->dmx_buffer[chan] != val) {
+            p->dmx_buffer[chan] = val;
+            mask[chan / 32] |= 1u << (chan % 32);
+        }
+    }
+    udmx_changed(p, mask);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_jit_matrix: 	a char or float32 matrix, cells row by row from the start address.
+//
+// 				with "plane n" one plane of it, so every object can take its universe from
+//				another plane. otherwise all planes, an RGB pixel gives three channels
+//----------------------------------------------------------------------------------------------------------------
+void udmx_jit_matrix(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
     
-    if (!(x->dev_handle)) {
-        if (chann < x->channel_changed_min) x->channel_changed_min = chann;
-         if (chann > x->channel_changed_max)x->channel_changed_max = chann;
-          udmx_tick(x);
-    } else {
-        nBytes = usb_control_msg(x->dev_handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                                 cmd_SetSingleChannel, x->dmx_buffer[chann], chann, NULL, 0, 200);
-        if(nBytes < 0)
-            if (x->debug_flag) error("udmx: USB error: %s", usb_strerror());
+    t_jit_matrix_info info;
+    t_uint8 values[UDMX_CHANNELS];
+    char *data, *row;
+    void *matrix;
+    long lock, planes, rows, cols, first, n = 0, r, i;
+    long room = UDMX_CHANNELS - x->channel;
+    
+    if (!ac || !(matrix = jit_object_findregistered(atom_getsym(av)))
+        || !jit_object_method(matrix, _jit_sym_class_jit_matrix)) {
+        object_error((t_object *)x, "jit_matrix: no matrix %s", ac ? atom_getsym(av)->s_name : "");
+        return;
+    }
+    lock = (long)jit_object_method(matrix, _jit_sym_lock, 1);
+    jit_object_method(matrix, _jit_sym_getinfo, &info);
+    jit_object_method(matrix, _jit_sym_getdata, &data);
+    
+    if (!data || (info.type != _jit_sym_char && info.type != _jit_sym_float32) || x->plane >= info.planecount) {
+        if (data) object_error((t_object *)x, "jit_matrix: only char and float32, plane %ld of %ld", x->plane, info.planecount);
+        jit_object_method(matrix, _jit_sym_lock, lock);
+        return;
+    }
+    first = x->plane < 0 ? 0 : x->plane;
+    planes = x->plane < 0 ? info.planecount : 1;
+    cols = info.dim[0];
+    rows = info.dimcount > 1 ? info.dim[1] : 1;
+    
+    for (r = 0; r < rows && n < room; r++) {
+        row = data + r * info.dimstride[1];
+        if (info.type == _jit_sym_char) {
+            t_uint8 *cell = (t_uint8 *)row + first;
+            long len = MIN(cols * planes, room - n);
+            if (planes == info.planecount) memcpy(values + n, cell, len);		// all planes: the row as it is
+            else for (i = 0; i < len; i++) values[n + i] = cell[i * info.planecount];
+            n += len;
+        } else {
+            float *cell = (float *)row + first;
+            long len = MIN(cols * planes, room - n);
+            if (planes == info.planecount) {
+                for (i = 0; i < len; i++) {		// no branches, the compiler vectorizes it
+                    float f = cell[i] * 255.f;
+                    f = f < 0.f ? 0.f : f;
+                    f = f > 255.f ? 255.f : f;
+                    values[n + i] = (t_uint8)f;
+                }
+            } else {
+                for (i = 0; i < len; i++) {
+                    float f = cell[i * info.planecount] * 255.f;
+                    f = f < 0.f ? 0.f : f;
+                    f = f > 255.f ? 255.f : f;
+                    values[n + i] = (t_uint8)f;
+                }
+            }
+            n += len;
+        }
     }
+    jit_object_method(matrix, _jit_sym_lock, lock);
+    udmx_set(x, x->channel, n, values);		// one universe, one diff, one flush
+}
+//----------------------------------------------------------------------------------------------------------------
+// which plane of a jit_matrix to read: "plane n", or "plane" / "plane -1" for all of them
+void udmx_plane(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
+    x->plane = ac && atom_gettype(av) != A_SYM ? atom_getlong(av) : -1;
+    if (x->plane < -1) x->plane = -1;
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_ramp: 	"ramp channel target ms" or "ramp channel count target ms"
+//
+// 				fade channels to target in ms, the sender thread steps the fade with every flush.
+//				targets are ints 0..255 or floats 0..1 as in the left inlet
+//----------------------------------------------------------------------------------------------------------------
+void udmx_ramp(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
+    
+    t_uint8 targets[UDMX_CHANNELS];
+    long chan, count = 1, val;
+    
+    if (ac < 3) return;
+    chan = atom_getlong(av);
+    if (ac > 3) count = atom_getlong(av + 1);
+    if (x->correct_adressing) chan--;
+    if (chan < 0 || chan >= UDMX_CHANNELS || count < 1) return;
+    if (count > UDMX_CHANNELS - chan) count = UDMX_CHANNELS - chan;
+    
+    if (atom_gettype(av + ac - 2) == A_FLOAT) val = atom_getfloat(av + ac - 2) * 255.;
+    else val = atom_getlong(av + ac - 2);
+    memset(targets, MIN(MAX(val, 0), 255), count);
+    udmx_ramp_start(x->port, chan, count, targets, atom_getfloat(av + ac - 1));
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_ramplist: 	"ramplist ms value value ..."
+//
+// 				fade the channels from the start address to the values of a list
+//----------------------------------------------------------------------------------------------------------------
+void udmx_ramplist(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
+    
+    t_uint8 targets[UDMX_CHANNELS];
+    long i, val;
+    
+    if (ac < 2) return;
+    for (i = 1; i < ac && x->channel + i - 1 < UDMX_CHANNELS; i++) {
+        if (atom_gettype(av + i) == A_FLOAT) val = atom_getfloat(av + i) * 255.;
+        else val = atom_getlong(av + i);
+        targets[i - 1] = MIN(MAX(val, 0), 255);
+    }
+    udmx_ramp_start(x->port, x->channel, i - 1, targets, atom_getfloat(av));
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_ramp_start
+//
+//	-> fades start from the values in the buffer, the sender thread does the rest
+//----------------------------------------------------------------------------------------------------------------
+void udmx_ramp_start(t_udmx_port *p, t_uint16 from, t_uint16 len, t_uint8 *targets, double ms) {
+    
+    systhread_mutex_lock(p->ramp_lock);
+    libudmx_ramp(&p->ramps, p->dmx_buffer, from, len, targets, ms, systime_ms());
+    atomic_store(&p->ramping, libudmx_ramps_active(&p->ramps));
+    systhread_mutex_unlock(p->ramp_lock);
+    udmx_wake(p, 0);
+}
+//----------------------------------------------------------------------------------------------------------------
+// stop the fades of these channels, only takes the lock if there are any
+void udmx_ramp_stop(t_udmx_port *p, t_uint16 from, t_uint16 len) {
+    
+    if (!atomic_load(&p->ramping)) return;
+    systhread_mutex_lock(p->ramp_lock);
+    libudmx_ramp_stop(&p->ramps, from, len);
+    atomic_store(&p->ramping, libudmx_ramps_active(&p->ramps));
+    systhread_mutex_unlock(p->ramp_lock);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_changed
+//
+//	-> hand the changed channels in mask over to the sender thread, urgent ones straight to libudmx
+//----------------------------------------------------------------------------------------------------------------
+void udmx_changed(t_udmx_port *p, const unsigned int *mask) {
+    
+    int w, changed = 0, urgent = 0;
+    
+    for (w = 0; w < DIRTY_WORDS; w++) {
+        if (mask[w] & ~p->urgent[w]) {
+            atomic_fetch_or_explicit(&p->dirty[w], mask[w] & ~p->urgent[w], memory_order_release);
+            changed = 1;
+        }
+        if (mask[w] & p->urgent[w]) urgent = 1;
+    }
+    if (urgent) udmx_send_urgent(p, mask);
+    if (changed) udmx_wake(p, 0);			// do nothing if no value changed
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_send_urgent
+//
+//	-> changed urgent channels go straight to libudmx, which only submits and never blocks.
+//	   bulk changes still wait for the sender thread
+//----------------------------------------------------------------------------------------------------------------
+void udmx_send_urgent(t_udmx_port *p, const unsigned int *mask) {
+    
+    libudmx_span spans[UDMX_CHANNELS / 2];
+    int nspans = 0;
+    t_uint16 chan;
+    
+    for (chan = 0; chan < UDMX_CHANNELS; chan++) {
+        if (!(mask[chan / 32] & p->urgent[chan / 32] & (1u << (chan % 32)))) continue;
+        if (nspans && spans[nspans-1].start + spans[nspans-1].len == chan) {
+            spans[nspans-1].len++;
+        } else {
+            spans[nspans].start = chan;
+            spans[nspans].len = 1;
+            spans[nspans].data = p->dmx_buffer + chan;
+            nspans++;
+        }
+    }
+    libudmx_apply(p->dev, spans, nspans);
+    if (libudmx_flush_urgent(p->dev) < 0) udmx_wake(p, 0);	// not connected, the sender thread looks for it
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_wake
+//
+// 	-> hand requests to the sender thread, only takes the lock if the thread may be waiting.
+//	   requests always signal, they end a pause that new data has woken already
+//----------------------------------------------------------------------------------------------------------------
+void udmx_wake(t_udmx_port *p, int requests) {
+    
+    if (requests) atomic_fetch_or(&p->requests, requests);
+    if (atomic_exchange(&p->wake_pending, 1) && !requests) return;	// already woken, not yet looked
+    
+    systhread_mutex_lock(p->wake_lock);
+    systhread_cond_signal(p->wake_cond);
+    systhread_mutex_unlock(p->wake_lock);
 }
 //----------------------------------------------------------------------------------------------------------------
-// udmx_send_range
+// udmx_wake_nowait
 //
-// 	-> update a range of channels
+// 	-> same for the DSP thread: if the sender holds its lock, leave it and try with the next frame
 //----------------------------------------------------------------------------------------------------------------
-void udmx_send_range(t_udmx *x, t_uint16 from, t_uint16 to) {
+void udmx_wake_nowait(t_udmx_port *p) {
     
-    if (!(x->dev_handle)) udmx_tick(x);
-    else {
-        t_uint16 i,len,nBytes;
-        from = MIN(MAX(from,0),510);
-        to = MIN(MAX(to,1),511);
+    if (atomic_exchange(&p->wake_pending, 1)) return;
+    if (systhread_mutex_trylock(p->wake_lock) == 0) {
+        systhread_cond_signal(p->wake_cond);
+        systhread_mutex_unlock(p->wake_lock);
+    } else atomic_store(&p->wake_pending, 0);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_sender
+//
+// 	-> sender thread, does all the USB I/O so that a slow or missing device
+//	   never holds up the scheduler or the main thread
+//----------------------------------------------------------------------------------------------------------------
+void *udmx_sender(t_udmx_port *p) {
+    
+    libudmx_span spans[UDMX_CHANNELS / 2];
+    int requests, nspans, w, rval;
+    unsigned int bits;
+    double interval;
+    
+    for (;;) {
+        // sleep until there is something to do
+        systhread_mutex_lock(p->wake_lock);
+        while (!atomic_exchange(&p->wake_pending, 0))
+            systhread_cond_wait(p->wake_cond, p->wake_lock);
+        systhread_mutex_unlock(p->wake_lock);
         
-        if (to <= from) {to = from+1;}
-        len = to - from + 1;
+        requests = atomic_exchange(&p->requests, 0);
+        if (requests & REQ_QUIT) break;
         
-        char* buf = malloc( len );
+        if (requests & REQ_CLOSE) libudmx_disconnect(p->dev);
         
-        for(i=0; i<len; i++) {
-            buf[i] = x->dmx_buffer[from+i];
+        // the values of the fades at this flush go out like changes from Max
+        if (atomic_load(&p->ramping)) {
+            unsigned int mask[DIRTY_WORDS];
+            
+            memset(mask, 0, sizeof(mask));
+            systhread_mutex_lock(p->ramp_lock);
+            libudmx_ramps_step(&p->ramps, systime_ms(), p->dmx_buffer, mask);
+            atomic_store(&p->ramping, libudmx_ramps_active(&p->ramps));
+            systhread_mutex_unlock(p->ramp_lock);
+            for (w = 0; w < DIRTY_WORDS; w++)
+                if (mask[w]) atomic_fetch_or_explicit(&p->dirty[w], mask[w], memory_order_release);
         }
         
-        nBytes = usb_control_msg(x->dev_handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-                                 cmd_SetChannelRange, len, from, buf, len, 1000);
+        // collect changed channels into spans
+        nspans = 0;
+        for (w = 0; w < DIRTY_WORDS; w++) {
+            bits = atomic_exchange_explicit(&p->dirty[w], 0, memory_order_acquire);
+            while (bits) {
+                t_uint16 chan = w * 32 + __builtin_ctz(bits);
+                bits &= bits - 1;
+                if (nspans && spans[nspans-1].start + spans[nspans-1].len == chan) spans[nspans-1].len++;
+                else {
+                    spans[nspans].start = chan;
+                    spans[nspans].len = 1;
+                    spans[nspans].data = p->dmx_buffer + chan;
+                    nspans++;
+                }
+            }
+        }
+        for (w = 0; w < nspans; w++) {
+            libudmx_apply(p->dev, spans + w, 1);
+            libudmx_mark_dirty(p->dev, spans[w].start, spans[w].len);	// we only see channels Max changed
+        }
         
-        if (x->debug_flag) post( "bytes returned: %i\n", nBytes);
-        if(nBytes < 0){
-            if (x->debug_flag) error("udmx: USB error: %s\n", usb_strerror());
-        } else if(nBytes > 0) { if (x->debug_flag) post("udmx: returned: %i\n", (int)(buf[0]));}
+        // look for the hardware if we have something to send or were asked to
+        if (!libudmx_is_connected(p->dev) && (nspans || libudmx_is_dirty(p->dev) || (requests & REQ_OPEN))) {
+            rval = libudmx_connect(p->dev);
+            if (rval != UDMX_BUS_UNCHANGED || (requests & REQ_OPEN)) {
+                strncpy(p->serial, libudmx_serial(p->dev), UDMX_SERIAL_LEN - 1);
+                atomic_store(&p->found, rval == UDMX_OK);
+                udmx_report(p);
+            }
+            if (rval != UDMX_OK) {
+                udmx_pause(p, RECONNECT_INTERVAL);		// open, close and quit don't wait for it
+                if (libudmx_is_dirty(p->dev)) udmx_wake(p, 0);	// try again, changes are kept until we find it
+                continue;
+            }
+        }
         
-        free(buf);
+        if (libudmx_flush(p->dev) < 0) {
+            if (p->debug_flag) error("udmx: USB error: %s", libudmx_strerror(p->dev));
+            if (!libudmx_is_connected(p->dev)) udmx_wake(p, REQ_OPEN);	// unplugged, report it and look again
+        }
+        
+        // changes meanwhile go out together after the pause. as long as the link needs to
+        // send them, and never faster than the device sends DMX frames. if the device tells
+        // us its frame clock, the next flush lands just before a BREAK instead
+        if (p->speedlim_min < p->speedlim_max && libudmx_next_frame(p->dev, NULL) >= 0.)
+            interval = libudmx_next_flush(p->dev, p->speedlim_min);
+        else
+            interval = libudmx_interval(p->dev);
+        if (interval < p->speedlim_min) interval = p->speedlim_min;
+        if (interval > p->speedlim_max) interval = p->speedlim_max;
+        if (libudmx_is_connected(p->dev)) {		// what udmx~ needs: a frame, or the speed limit
+            double frame = libudmx_interval(p->dev);
+            if (frame < p->speedlim_min) frame = p->speedlim_min;
+            if (frame > p->speedlim_max) frame = p->speedlim_max;
+            atomic_store(&p->frame_us, frame * 1e3 > FRAME_US_MIN ? (int)(frame * 1e3) : FRAME_US_MIN);
+        }
+        if (atomic_load(&p->ramping)) {			// fades go on by themselves, one step per frame
+            if (interval < atomic_load(&p->frame_us) / 1e3) interval = atomic_load(&p->frame_us) / 1e3;
+            atomic_store(&p->wake_pending, 1);
+        }
+        if (interval >= 1.) udmx_pause(p, interval);
     }
+    libudmx_disconnect(p->dev);
+    return NULL;
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_pause
+//
+// 	-> wait ms on the wake condition: quit, open and close end it at once, new
+//	   data waits for the rest of it, so that it goes out together
+//----------------------------------------------------------------------------------------------------------------
+void udmx_pause(t_udmx_port *p, double ms) {
     
+    t_uint32 start = systime_ms(), wait = (t_uint32)(ms + .5), elapsed;
+    
+    systhread_mutex_lock(p->wake_lock);
+    while (!atomic_load(&p->requests) && (elapsed = (t_uint32)(systime_ms() - start)) < wait)
+        systhread_cond_timedwait(p->wake_cond, p->wake_lock, wait - elapsed);
+    systhread_mutex_unlock(p->wake_lock);
 }
 //----------------------------------------------------------------------------------------------------------------
-// clock tick
-void udmx_tick(t_udmx *x) {
-
-    if (!(x->dev_handle)) {
-        qelem_set(x->m_qelem);
-      //  clock_fdelay(x->m_clock,4000); //check again periodically
-        return;
-    }
-
-    if (x->channel_changed_min < 512) { // there was a change since we last sent something
-        
-        if (x->channel_changed_max - x->channel_changed_min) {
-            udmx_send_range(x,x->channel_changed_min,x->channel_changed_max);
-        } else {
-            udmx_send_single(x,x->channel_changed_min);
-        }
-        
-    }
+// transfer policy: deadline in ms, retries, backoff in ms. libudmx locks, safe next to the sender thread
+void udmx_policy(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
+    libudmx_policy policy;
     
-    x->channel_changed_min = 512;
-    x->channel_changed_max = -1;
-    x->clock_running = 0;
+    libudmx_get_policy(x->port->dev, &policy);
+    if (ac > 0) policy.deadline = atom_getlong(av);
+    if (ac > 1) policy.retries = atom_getlong(av + 1);
+    if (ac > 2) policy.backoff = atom_getlong(av + 2);
+    libudmx_set_policy(x->port->dev, &policy);
+}
+//----------------------------------------------------------------------------------------------------------------
+// channel priority: "priority channel 1/0" or "priority channel count 1/0"
+void udmx_priority(t_udmx *x, t_symbol *s, short ac, t_atom *av) {
+    long chan, count = 1, urgent, i;
+    
+    if (ac < 2) return;
+    chan = atom_getlong(av);
+    if (ac > 2) count = atom_getlong(av + 1);
+    urgent = atom_getlong(av + ac - 1) != 0;
+    if (x->correct_adressing) chan--;
+    if (chan < 0 || chan >= UDMX_CHANNELS || count < 1) return;
+    if (count > UDMX_CHANNELS - chan) count = UDMX_CHANNELS - chan;
     
+    for (i = chan; i < chan + count; i++) {
+        if (urgent) x->port->urgent[i / 32] |= 1u << (i % 32);
+        else x->port->urgent[i / 32] &= ~(1u << (i % 32));
+    }
+    libudmx_set_priority(x->port->dev, chan, count, urgent);	// also goes first next to bulk changes
 }
 //----------------------------------------------------------------------------------------------------------------
-// set speed limit in ms
-void udmx_speedlim(t_udmx *x, t_uint16 n){
-    if (n < 0) n = 0;
-    x->speedlim = n;
-    x->clock_running = 0;
+// set speed limit in ms: "speedlim n" is fixed, "speedlim min max" adapts between the two,
+// "speedlim auto" adapts to the link. the limit is the device's, the last object to set it wins
+void udmx_speedlim(t_udmx *x, t_symbol *s, short ac, t_atom *av){
+    long lo, hi;
+    
+    if (!ac || atom_gettype(av) == A_SYM) {
+        lo = 0;
+        hi = SPEED_LIMIT_MAX;
+    } else {
+        lo = hi = atom_getlong(av);
+        if (ac > 1) hi = atom_getlong(av + 1);
+    }
+    if (lo < 0) lo = 0;
+    if (hi < lo) hi = lo;
+    if (hi > 65535) hi = 65535;
+    if (lo > hi) lo = hi;
+    x->port->speedlim_min = lo;
+    x->port->speedlim_max = hi;
 }
 //----------------------------------------------------------------------------------------------------------------
 // establish connection with the udmx hardware
 void udmx_open(t_udmx *x){
     
-    if (x->dev_handle) {
+    if (x->connected) {
         udmx_message(x,gensym("There is already a connection to www.anyma.ch/udmx"));
 #ifdef PUREDATA   	// compiling for PUREDATA
         outlet_float(x->statusOutlet,1);
 #else				// compiling for MaxMSP
         outlet_int(x->statusOutlet,1);
 #endif				// Max/PD switch
-    } else         find_device(x);
+    } else         udmx_wake(x->port, REQ_OPEN);
 }
 //----------------------------------------------------------------------------------------------------------------
-// establish connection with the udmx hardware by serial number
+// establish connection with the udmx hardware by serial number: move over to its port,
+// the device we leave stays open for the other objects that use it
 void udmx_bind(t_udmx *x, t_symbol *s) {
-    if (x->dev_handle) { udmx_close(x); }
     
-    if (s == gensym("")) {
-        x->bind_to[0] = 0;
-    } else {
-        strcpy(x->bind_to,s->s_name);
+    t_udmx_port *old = x->port;
+    
+    if (s == old->key) return;
+    if (!udmx_port_acquire(x, s)) {			// we keep the port we have
+        object_error((t_object *)x, "out of memory, still bound to %s", old->key->s_name[0] ? old->key->s_name : "the first uDMX");
+        return;
     }
-    x->usb_devices_seen = -1;
-    find_device(x);
+    x->connected = 0;
+    udmx_port_release(old, x);
 }
 
 //----------------------------------------------------------------------------------------------------------------
 // post serial number
 void udmx_getSerial(t_udmx *x){
 
-    if (x->dev_handle) {
+    if (x->connected) {
         t_atom argv[1];
-        atom_setsym(argv, gensym(x->serial_number));
+        atom_setsym(argv, gensym(x->port->serial));
         outlet_anything(x->msgOutlet, gensym ("serial"), 1, argv);
     } else {
         outlet_anything(x->msgOutlet, gensym ("Not connected to an udmx"), 0, NULL);
@@ -352,15 +724,18 @@ void udmx_getSerial(t_udmx *x){
 }
 
 void udmx_blackout(t_udmx *x){
-    t_uint16 i;
-    for (i = 0; i < 512; i++){
-        x->dmx_buffer[i] = 0;
-    }
-    udmx_send_range(x, 0, 511);
+    t_udmx_port *p = x->port;
+    int w;
+    
+    udmx_ramp_stop(p, 0, UDMX_CHANNELS);
+    memset(p->dmx_buffer, 0, UDMX_CHANNELS);
+    for (w = 0; w < DIRTY_WORDS; w++)			// send all, even if we think they're 0 already
+        atomic_store_explicit(&p->dirty[w], 0xffffffffu, memory_order_release);
+    udmx_wake(p, 0);
 }
 
 //----------------------------------------------------------------------------------------------------------------
-// close connection to hardware
+// close connection to hardware, for all objects that share it
 void udmx_close(t_udmx *x){
 #ifdef PUREDATA   	// compiling for PUREDATA
     outlet_float(x->statusOutlet,0);
@@ -368,10 +743,9 @@ void udmx_close(t_udmx *x){
     outlet_int(x->statusOutlet,0);
 #endif				// Max/PD switch
     
-    if (x->dev_handle) {
-        usb_close(x->dev_handle);
-        x->usb_devices_seen = -1;
-        x->dev_handle = NULL;
+    if (x->connected) {
+        x->connected = 0;
+        udmx_wake(x->port, REQ_CLOSE);
         udmx_message(x,gensym("Closed connection to www.anyma.ch/udmx"));
     } else
         udmx_message(x,gensym("There was no open connection to www.anyma.ch/udmx"));
@@ -394,7 +768,7 @@ void udmx_assist(t_udmx *x, void *b, t_uint16 m, t_uint16 a, char *s) {
     } else {
         switch (a) {
             case 0:
-                sprintf(s,"DMX Packet (list)");
+                sprintf(s,"DMX Packet (list, jit_matrix), set channel value ..., ramp channel target ms");
                 break;
             case 1:
                 sprintf(s,"Start address (int)");
@@ -417,6 +791,11 @@ int C74_EXPORT main(void){
     class_addmethod(c, (method)udmx_int,			"int",		A_LONG, 0);
     class_addmethod(c, (method)udmx_in1,			"in1",		A_LONG, 0);
     class_addmethod(c, (method)udmx_list,			"list", A_GIMME, 0);
+    class_addmethod(c, (method)udmx_set_pairs,		"set", A_GIMME, 0);
+    class_addmethod(c, (method)udmx_jit_matrix,		"jit_matrix", A_GIMME, 0);
+    class_addmethod(c, (method)udmx_plane,			"plane", A_GIMME, 0);
+    class_addmethod(c, (method)udmx_ramp,			"ramp", A_GIMME, 0);
+    class_addmethod(c, (method)udmx_ramplist,		"ramplist", A_GIMME, 0);
 
     class_addmethod(c, (method)udmx_float,			"float",	A_FLOAT, 0);
     class_addmethod(c, (method)udmx_open,			"open", 0);
@@ -424,13 +803,24 @@ int C74_EXPORT main(void){
     
     class_addmethod(c, (method)udmx_getSerial,		"get_serial", 0);
     class_addmethod(c, (method)udmx_close, 			"close", 0);
-    class_addmethod(c, (method)udmx_speedlim, 		"speedlim", A_FLOAT,0);
+    class_addmethod(c, (method)udmx_speedlim, 		"speedlim", A_GIMME,0);
+    class_addmethod(c, (method)udmx_policy, 		"policy", A_GIMME,0);
+    class_addmethod(c, (method)udmx_priority, 		"priority", A_GIMME,0);
     class_addmethod(c, (method)udmx_bind, 			"bind", A_DEFSYM,0);
 
     class_register(CLASS_BOX, c);
+    systhread_mutex_new(&registry_lock, SYSTHREAD_MUTEX_NORMAL);
     
     udmx_class = c;
     
+    c = class_new("udmx~", (method)udmx_tilde_new, (method)udmx_tilde_free, (long)sizeof(t_udmx_tilde),
+                  0L, A_GIMME, 0);
+    class_addmethod(c, (method)udmx_tilde_dsp64,	"dsp64",	A_CANT, 0);
+    class_addmethod(c, (method)udmx_tilde_assist,	"assist",	A_CANT, 0);
+    class_dspinit(c);
+    class_register(CLASS_BOX, c);
+    udmx_tilde_class = c;
+    
     return 0;
 }
 
@@ -450,13 +840,13 @@ void *udmx_new(t_symbol *s, long argc, t_atom *argv)	{
     
     t_udmx *x = (t_udmx *)object_alloc(udmx_class);
     intin(x,1);					// create a second int inlet (leftmost inlet is automatic - all objects have one inlet by default)
-    x->m_clock = clock_new(x,(method)udmx_tick); 	// make new clock for polling and attach tick function to it
-    x->m_qelem = qelem_new((t_object *)x, (method)find_device);
+    x->m_qelem = qelem_new((t_object *)x, (method)udmx_status);
     
     x->msgOutlet = outlet_new(x,0L);	//create right outlet
     x->statusOutlet = outlet_new(x,0L);	//create an outlet for connected flag
     
     x->correct_adressing = 1;
+    x->plane = -1;
     
     if (argc) {
         ap = argv;
@@ -484,140 +874,137 @@ void *udmx_new(t_symbol *s, long argc, t_atom *argv)	{
     if (n > 511) n = 511;
 
     x->channel = n;
-    x->debug_flag = 0;
-    x->channel_changed_min = 512;
-    x->channel_changed_max = -1;
-    x->clock_running = 0;
-    x->dev_handle = NULL;
-    x->speedlim = SPEED_LIMIT;
-    x->usb_devices_seen = -1;
-
-    
-    clock_fdelay(x->m_clock,100);
-    usb_init();
+    x->connected = 0;
+    if (!udmx_port_acquire(x, gensym(""))) {
+        qelem_free(x->m_qelem);
+        object_error((t_object *)x, "out of memory");
+        return NULL;
+    }
     
     return(x);					// return a reference to the object instance
 }
 //----------------------------------------------------------------------------------------------------------------
 // object destruction
 void udmx_free(t_udmx *x){
-    object_free(x->m_clock);
+    if (x->port) udmx_port_release(x->port, x);		// before the qelem goes, the sender may still report to us
     qelem_free(x->m_qelem);
-    if (x->dev_handle)
-        udmx_close(x);
-}
-//----------------------------------------------------------------------------------------------------------------
-// USB HELPER FUNCTIONS
-static int  usbGetStringAscii(usb_dev_handle *dev, t_uint16 index, t_uint16 langid, char *buf, t_uint16 buflen){
-    
-    char    buffer[256];
-    t_uint16     rval, i;
-    
-    if((rval = usb_control_msg(dev, USB_ENDPOINT_IN, USB_REQ_GET_DESCRIPTOR, (USB_DT_STRING << 8) + index, langid, buffer, sizeof(buffer), 1000)) < 0)
-        return rval;
-    if(buffer[1] != USB_DT_STRING)
-        return 0;
-    if((unsigned char)buffer[0] < rval)
-        rval = (unsigned char)buffer[0];
-    rval /= 2;
-    /* lossy conversion to ISO Latin1 */
-    for(i=1;i<rval;i++){
-        if(i > buflen)  /* destination buffer overflow */
-            break;
-        buf[i-1] = buffer[2 * i];
-        if(buffer[2 * i + 1] != 0)  /* outside of ISO Latin1 range */
-            buf[i-1] = '?';
-    }
-    buf[i-1] = 0;
-    return i-1;
 }
-
-char isOurVIDandPID(struct usb_device const* dev) {
-    return dev->descriptor.idVendor == USBDEV_SHARED_VENDOR &&
-    (dev->descriptor.idProduct == USBDEV_SHARED_PRODUCT ||
-     dev->descriptor.idProduct == USBDEV_SHARED_PRODUCT_HID ||
-     dev->descriptor.idProduct == USBDEV_SHARED_PRODUCT_MIDI);
+//----------------------------------------------------------------------------------------------------------------
+// udmx_port_acquire
+//
+//	-> join the port of the device with this serial number, "" for the first one found.
+//	   creates the port and starts its sender thread for the first object.
+//	   x gets the connection reports, NULL for udmx~
+t_udmx_port *udmx_port_acquire(t_udmx *x, t_symbol *key) {
+    
+    t_udmx_port *p;
+    int w;
+    
+    systhread_mutex_lock(registry_lock);
+    for (p = registry; p && p->key != key; p = p->next) ;
+    if (!p) {
+        if (!(p = (t_udmx_port *)sysmem_newptrclear(sizeof(t_udmx_port)))
+            || !(p->dev = libudmx_new(key->s_name))) {
+            if (p) sysmem_freeptr(p);
+            systhread_mutex_unlock(registry_lock);
+            return NULL;
+        }
+        p->key = key;
+        p->speedlim_min = 0;
+        p->speedlim_max = SPEED_LIMIT_MAX;
+        for (w = 0; w < DIRTY_WORDS; w++) atomic_init(&p->dirty[w], 0);
+        atomic_init(&p->requests, REQ_OPEN);		// look for the hardware right away
+        atomic_init(&p->found, 0);
+        atomic_init(&p->reported, 0);
+        atomic_init(&p->frame_us, FRAME_US_DEFAULT);
+        atomic_init(&p->wake_pending, 1);
+        atomic_init(&p->ramping, 0);
+        libudmx_ramps_init(&p->ramps);
+        systhread_mutex_new(&p->ramp_lock, SYSTHREAD_MUTEX_NORMAL);
+        systhread_mutex_new(&p->wake_lock, SYSTHREAD_MUTEX_NORMAL);
+        systhread_cond_new(&p->wake_cond, 0);
+        p->next = registry;
+        registry = p;
+        systhread_create((method)udmx_sender, p, 0, 0, 0, &p->thread);
+    } else if (x && atomic_load(&p->reported)) {
+        qelem_set(x->m_qelem);					// the port knows already, tell the new object
+    }
+    p->refcount++;
+    if (x) {
+        x->port = p;
+        x->next_member = p->members;
+        p->members = x;
+    }
+    systhread_mutex_unlock(registry_lock);
+    return p;
 }
-
-
-void find_device(t_udmx *x) {
-    usb_dev_handle      *handle = NULL;
-    struct usb_bus      *bus;
-    struct usb_device   *dev;
+//----------------------------------------------------------------------------------------------------------------
+// udmx_port_release
+//
+//	-> leave the port, the last object stops its sender thread and closes the device
+void udmx_port_release(t_udmx_port *p, t_udmx *x) {
     
-    t_int16 device_count;
+    t_udmx_port **pp;
+    t_udmx **m;
+    unsigned int ret;
+    int last;
     
-    usb_find_busses();
-    device_count = usb_find_devices();
-    if (device_count == x->usb_devices_seen) {
-        return;
+    systhread_mutex_lock(registry_lock);
+    for (m = &p->members; x && *m; m = &(*m)->next_member) {
+        if (*m == x) {
+            *m = x->next_member;
+            break;
+        }
     }
-    x->usb_devices_seen = device_count;
-    
-    for(bus=usb_busses; bus; bus=bus->next){
-        for(dev=bus->devices; dev; dev=dev->next){
-            if(isOurVIDandPID(dev)){
-                char    string[256];
-                int     len;
-                handle = usb_open(dev); /* we need to open the device in order to query strings */
-                if(!handle){
-                    error ("Warning: cannot open USB device: %s", usb_strerror());
-                    continue;
-                }
-                /* now find out whether the device actually is obdev's Remote Sensor: */
-                len = usbGetStringAscii(handle, dev->descriptor.iManufacturer, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    error("udmx: warning: cannot query manufacturer for device: %s", usb_strerror());
-                    goto skipDevice;
-                }
-                /* post("udmx: seen device from vendor ->%s<-", string); */
-                if(strcmp(string, "www.anyma.ch") != 0)
-                    goto skipDevice;
-                len = usbGetStringAscii(handle, dev->descriptor.iProduct, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    error("udmx: warning: cannot query product for device: %s", usb_strerror());
-                    goto skipDevice;
-                }
-                // post("udmx: seen product ->%s<-", string);
-                if(strcmp(string, "udmx") == 0 || strcmp(string, "uDMX") == 0) {
-                    // we've found a udmx device. get serial number
-                    
-                    if	 (dev->descriptor.iSerialNumber) {
-                        len = usb_get_string_simple(handle, dev->descriptor.iSerialNumber, x->serial_number, sizeof (x->serial_number));
-                        if (len == 0) {
-                            error("Unable to fetch serial number string");
-                        }
-                    }
-                    
-                    //see if we're looking for a specific serial number
-                    if (x->bind_to[0]) {
-                        if (strcmp(x->bind_to,x->serial_number)) {
-                            post("Found device for another serial number: %s\n", x->serial_number);	
-                            goto skipDevice;
-                        }
-                    }
-                    
-                    break;
-                }
-            skipDevice:
-                usb_close(handle);
-                handle = NULL;
+    if ((last = --p->refcount == 0)) {
+        for (pp = &registry; *pp; pp = &(*pp)->next) {
+            if (*pp == p) {
+                *pp = p->next;
+                break;
             }
         }
-        if(handle)
-            break;
     }
+    systhread_mutex_unlock(registry_lock);
+    if (x && x->port == p) x->port = NULL;	// bind has given it a new one already
+    if (!last) return;
+    
+    udmx_wake(p, REQ_QUIT);
+    systhread_join(p->thread, &ret);		// the thread closes the connection
+    systhread_cond_free(p->wake_cond);
+    systhread_mutex_free(p->wake_lock);
+    systhread_mutex_free(p->ramp_lock);
+    libudmx_free(p->dev);
+    sysmem_freeptr(p);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_report
+//
+//	-> the sender thread has news about the connection, every object of the port reports it
+void udmx_report(t_udmx_port *p) {
+    
+    t_udmx *x;
+    
+    atomic_store(&p->reported, 1);
+    systhread_mutex_lock(registry_lock);
+    for (x = p->members; x; x = x->next_member) qelem_set(x->m_qelem);
+    systhread_mutex_unlock(registry_lock);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_status
+//
+//	-> report what the sender thread found, runs on the main thread
+void udmx_status(t_udmx *x) {
+    
+    x->connected = atomic_load(&x->port->found);
     
-    if(!handle){
+    if (!x->connected) {
         udmx_message(x,gensym("Could not find USB device www.anyma.ch/udmx"));
 #ifdef PUREDATA   	// compiling for PUREDATA 
         outlet_float(x->statusOutlet,0);
 #else				// compiling for MaxMSP
         outlet_int(x->statusOutlet,0);
 #endif				// Max/PD switch
-        x->dev_handle = NULL;
     } else {
-        x->dev_handle = handle;
 #ifdef PUREDATA   	// compiling for PUREDATA 
         outlet_float(x->statusOutlet,1);
 #else				// compiling for MaxMSP
@@ -625,4 +1012,95 @@ void find_device(t_udmx *x) {
 #endif				// Max/PD switch
         udmx_message(x,gensym("Found USB device www.anyma.ch/udmx"));
     }
-}
\ No newline at end of file
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx~
+//----------------------------------------------------------------------------------------------------------------
+// object creation: [udmx~ channels start serial], start is 1-based, serial for a particular device
+void *udmx_tilde_new(t_symbol *s, long argc, t_atom *argv) {
+    
+    t_udmx_tilde *x;
+    t_symbol *serial = gensym("");
+    long channels = 1, start = 1, numbers = 0, i;
+    
+    for (i = 0; i < argc; i++) {
+        if (atom_gettype(argv + i) == A_SYM) serial = atom_getsym(argv + i);
+        else if (numbers++ == 0) channels = atom_getlong(argv + i);
+        else start = atom_getlong(argv + i);
+    }
+    if (start < 1) start = 1;
+    if (start > UDMX_CHANNELS) start = UDMX_CHANNELS;
+    if (channels < 1) channels = 1;
+    if (channels > UDMX_CHANNELS - start + 1) channels = UDMX_CHANNELS - start + 1;
+    
+    x = (t_udmx_tilde *)object_alloc(udmx_tilde_class);
+    dsp_setup((t_pxobject *)x, channels);		// one signal inlet per channel
+    x->start = start - 1;
+    x->channels = channels;
+    x->samplerate = sys_getsr();
+    x->countdown = 0;
+    if (!(x->port = udmx_port_acquire(NULL, serial))) {
+        object_error((t_object *)x, "out of memory");
+        dsp_free((t_pxobject *)x);
+        return NULL;
+    }
+    return x;
+}
+//----------------------------------------------------------------------------------------------------------------
+// object destruction
+void udmx_tilde_free(t_udmx_tilde *x) {
+    dsp_free((t_pxobject *)x);				// the perform routine is gone before the port
+    if (x->port) udmx_port_release(x->port, NULL);
+}
+//----------------------------------------------------------------------------------------------------------------
+void udmx_tilde_dsp64(t_udmx_tilde *x, t_object *dsp64, short *count, double samplerate, long maxvectorsize, long flags) {
+    x->samplerate = samplerate;
+    x->countdown = 0;
+    object_method(dsp64, gensym("dsp_add64"), x, udmx_tilde_perform64, 0, NULL);
+}
+//----------------------------------------------------------------------------------------------------------------
+// udmx_tilde_perform64
+//
+//	-> take the value of every inlet at the start of each DMX frame that falls into this vector,
+//	   changes go into the universe of the port and to the sender thread. never blocks
+//----------------------------------------------------------------------------------------------------------------
+void udmx_tilde_perform64(t_udmx_tilde *x, t_object *dsp64, double **ins, long numins, double **outs, long numouts, long sampleframes, long flags, void *userparam) {
+    
+    t_udmx_port *p = x->port;
+    unsigned int mask[DIRTY_WORDS];
+    double at = x->countdown, period, f;
+    long c, n;
+    int w, changed = 0;
+    t_uint8 val;
+    
+    if (at >= sampleframes) {				// nothing due in this vector
+        x->countdown = at - sampleframes;
+        return;
+    }
+    period = x->samplerate * atomic_load(&p->frame_us) / 1e6;
+    memset(mask, 0, sizeof(mask));
+    for (; at < sampleframes; at += period) {
+        n = (long)at;
+        for (c = 0; c < numins && c < x->channels; c++) {
+            f = ins[c][n];
+            if (f > 1.) f = 1.;
+            if (f < 0) f = 0;
+            val = f * 255.;
+            if (p->dmx_buffer[x->start + c] != val) {
+                p->dmx_buffer[x->start + c] = val;
+                mask[(x->start + c) / 32] |= 1u << ((x->start + c) % 32);
+                changed = 1;
+            }
+        }
+    }
+    x->countdown = at - sampleframes;
+    if (!changed) return;
+    
+    for (w = 0; w < DIRTY_WORDS; w++)		// urgent channels too, libudmx would take its lock
+        if (mask[w]) atomic_fetch_or_explicit(&p->dirty[w], mask[w], memory_order_release);
+    udmx_wake_nowait(p);
+}
+//----------------------------------------------------------------------------------------------------------------
+void udmx_tilde_assist(t_udmx_tilde *x, void *b, long m, long a, char *s) {
+    if (m == ASSIST_INLET) sprintf(s, "(signal) Channel %ld, 0..1", x->start + a + 1);
+}
@@ -1,274 +1,660 @@
 /*
 	udmx.c
-	
+
 	pd-Interface to the [ a n y m a | udmx - Open Source USB Sensor Box ]
-	
+
 	Authors:	Michael Egger
 	Copyright:	2007 [ a n y m a ]
 	Website:	www.anyma.ch
-	
+
 	License:	GNU GPL 2.0 www.gnu.org
-	
-	Version:	0.2	2009-06-30	
+
+	Version:	0.4	2026-10-19
+				0.3	2026-10-19
+				0.2	2009-06-30
 				0.1 2007-01-28
+
+	Values go into the universe of the libudmx handle, which drops the ones
+	that did not change. Sending happens from a Pd clock: everything that
+	changes in one logical tick, and until the speed limit allows the next
+	flush, goes out together. The clock also looks for the device when it is
+	not connected, at most every RECONNECT_INTERVAL ms, so messages never wait
+	for USB. Opening it and asking what it can do takes a while, libudmx does
+	that on a thread of its own and the clock checks every CONNECT_POLL ms if
+	it is done.
+
+	Objects that use the same device share its port: the handle, the clock
+	and the speed limit. [udmx~ channels start] has one signal inlet per
+	channel, 0..1, and takes one value per channel and DMX frame in the DSP
+	routine. It lives in this library too, load it with [declare -lib uDMX]
+	or -lib uDMX so that [udmx~] is there before the first [udmx]. Pd calls
+	the setup function after the file, uDMX_setup, typing [udmx] on a file
+	system that ignores case finds the same file and calls udmx_setup.
+
+	[ramp channel target ms] fades inside the object: the clock computes the
+	values of all fades of the port with every flush and keeps going until
+	they have arrived. Setting a channel by hand ends its fade.
 	*/
 
 #include "m_pd.h"
 
-#include "../common/uDMX_cmds.h"
+#include "../libudmx/libudmx.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
-#include "usb.h"    /* this is libusb, see http://libusb.sourceforge.net/ */
 
-#define USBDEV_SHARED_VENDOR    0x16C0  /* VOTI */
-#define USBDEV_SHARED_PRODUCT   0x05DC  /* Obdev's free shared PID */
+#define SPEED_LIMIT_MAX			100		//  ceiling of the adaptive speed limit in ms
+#define RECONNECT_INTERVAL		250		//  ms between attempts to find the hardware
+#define CONNECT_POLL			10		//  ms between checks if an attempt has finished
+#define FRAME_DEFAULT			22.754	//  ms per DMX frame of a full universe, until we know better
+#define FRAME_MIN				1.		//  udmx~ takes values at most this often
+
+typedef struct _udmx_port			// one device, shared by all objects that use it
+{
+	struct _udmx_port *next;		// in the list of ports
+	t_symbol	*key;				// serial number, "" for the first uDMX found
+	int		refcount;				// objects using the port
+	libudmx_device	*dev;			// handle to the udmx usb device, keeps our universe
+	t_clock	*clock;					// sends the changes, and looks for the device
+	int		clock_set;
+	double	flushed;				// logical time of the last flush
+	double	interval;				// ms until the next flush may go out
+	double	frame;					// ms between flushes the link sustains, udmx~ takes values at this rate
+	double	searched;				// logical time of the last attempt to find the device
+	int		search;					// look for it on the next tick, whatever the time
+	int		connecting;				// an attempt is running, the clock waits for its result
+	int		speedlim_min;			// floor and ceiling of the speed limit in ms,
+	int		speedlim_max;			// in between it follows what the link sustains
+	int	debug_flag;
+	libudmx_ramps	ramps;			// fades, stepped by the clock
+	double	epoch;					// logical time the ramps count from
+} t_udmx_port;
 
 typedef struct _udmx				// defines our object's internal variables for each instance in a patch
 {
 	t_object p_ob;					// object header - ALL objects MUST begin with this...
-	usb_dev_handle	*dev_handle;	// handle to the udmx usb device
-	int	debug_flag;
+	t_udmx_port	*port;				// the device we write to
 	int channel;					// int value - received from the right inlet and stored internally for each object instance
 } t_udmx;
 
-void *udmx_class;					// global pointer to the object class - so max can reference the object 
+typedef struct _udmx_tilde			// [udmx~], one signal inlet per channel
+{
+	t_object p_ob;
+	t_float	f;						// for the main signal inlet
+	t_udmx_port	*port;
+	int		start;					// channel of the first inlet
+	int		channels;				// number of inlets
+	t_sample	**ins;				// their signal vectors, set in the dsp method
+	double	samplerate;
+	double	countdown;				// samples until we take the next values
+} t_udmx_tilde;
+
+void *udmx_class;					// global pointer to the object class - so max can reference the object
+t_class *udmx_tilde_class;
+static t_udmx_port *ports = NULL;	// Pd calls us from one thread, no lock needed
 
 
 
 // these are prototypes for the methods that are defined below
-void udmx_int(t_udmx *x, long n);
+void udmx_int(t_udmx *x, t_floatarg f);
 void udmx_ft1(t_udmx *x, t_floatarg f);
-void udmx_debug(t_udmx *x,  t_symbol *s, short ac, t_atom *av);
-void udmx_list(t_udmx *x, t_symbol *s, short ac, t_atom *av);
+void udmx_debug(t_udmx *x,  t_symbol *s, int ac, t_atom *av);
+void udmx_policy(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_speedlim(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_list(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_set(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_array(t_udmx *x, t_symbol *name, t_floatarg onset);
+void udmx_ramp(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_ramplist(t_udmx *x, t_symbol *s, int ac, t_atom *av);
+void udmx_ramp_start(t_udmx_port *p, int from, int len, unsigned char *targets, double ms);
 void udmx_open(t_udmx *x);
 void udmx_close(t_udmx *x);
-void *udmx_new(long n);
-static int  usbGetStringAscii(usb_dev_handle *dev, int index, int langid, char *buf, int buflen);
-void find_device(t_udmx *x);
+void udmx_free(t_udmx *x);
+void *udmx_new(void);
+int find_device(t_udmx_port *p);
+void udmx_send(t_udmx *x, int from, int len, unsigned char *values);
+void udmx_schedule(t_udmx_port *p);
+void udmx_tick(t_udmx_port *p);
+t_udmx_port *udmx_port_acquire(t_symbol *key);
+void udmx_port_release(t_udmx_port *p);
+void *udmx_tilde_new(t_symbol *s, int ac, t_atom *av);
+void udmx_tilde_free(t_udmx_tilde *x);
+void udmx_tilde_dsp(t_udmx_tilde *x, t_signal **sp);
+t_int *udmx_tilde_perform(t_int *w);
+void uDMX_setup(void);
 
 //--------------------------------------------------------------------------
 
 void udmx_setup(void)
 {
+	if (udmx_class) return;			// loaded as [udmx] and as the library uDMX
+
+	udmx_class = class_new ( gensym("udmx"),(t_newmethod)udmx_new, (t_method)udmx_free, sizeof(t_udmx), 	CLASS_DEFAULT,0);
 
-	udmx_class = class_new ( gensym("udmx"),(t_newmethod)udmx_new, 0, sizeof(t_udmx), 	CLASS_DEFAULT,0);
-	
 	class_addfloat(udmx_class, (t_method)udmx_int);			// the method for an int in the left inlet (inlet 0)
+	class_addmethod(udmx_class, (t_method)udmx_ft1, gensym("ft1"), A_FLOAT, 0);	// the channel in the right inlet
 	class_addmethod(udmx_class, (t_method)udmx_debug,gensym("debug"), A_GIMME, 0);
+	class_addmethod(udmx_class, (t_method)udmx_policy,gensym("policy"), A_GIMME, 0);
+	class_addmethod(udmx_class, (t_method)udmx_speedlim,gensym("speedlim"), A_GIMME, 0);
 	class_addlist(udmx_class, (t_method)udmx_list);
-	class_addmethod(udmx_class, (t_method)udmx_open, gensym("open"), 0);		
-	class_addmethod(udmx_class, (t_method)udmx_close, gensym("close"), 0);	
+	class_addmethod(udmx_class, (t_method)udmx_set, gensym("set"), A_GIMME, 0);
+	class_addmethod(udmx_class, (t_method)udmx_array, gensym("array"), A_SYMBOL, A_DEFFLOAT, 0);
+	class_addmethod(udmx_class, (t_method)udmx_ramp, gensym("ramp"), A_GIMME, 0);
+	class_addmethod(udmx_class, (t_method)udmx_ramplist, gensym("ramplist"), A_GIMME, 0);
+	class_addmethod(udmx_class, (t_method)udmx_open, gensym("open"), 0);
+	class_addmethod(udmx_class, (t_method)udmx_close, gensym("close"), 0);
+
+	udmx_tilde_class = class_new(gensym("udmx~"), (t_newmethod)udmx_tilde_new, (t_method)udmx_tilde_free,
+								 sizeof(t_udmx_tilde), CLASS_DEFAULT, A_GIMME, 0);
+	CLASS_MAINSIGNALIN(udmx_tilde_class, t_udmx_tilde, f);
+	class_addmethod(udmx_tilde_class, (t_method)udmx_tilde_dsp, gensym("dsp"), 0);
 
 	post("udmx version 0.9 - (c) 2006 [ a n y m a ]",0);	// post any important info to the max window when our object is laoded
 }
+
+void uDMX_setup(void)				// -lib uDMX and [declare -lib uDMX] look for this one
+{
+	udmx_setup();
+}
 //--------------------------------------------------------------------------
 
-void udmx_int(t_udmx *x, long n)	// x = the instance of the object; n = the int received in the left inlet 
+void udmx_int(t_udmx *x, t_floatarg f)	// x = the instance of the object; f = the value received in the left inlet
 {
-	unsigned char       buffer[8];
-	int                 nBytes;
+	unsigned char val;
+	int n = f;
 
 	if (n > 255) n=255;
 	if (n < 0) n=0;
-	if (x->channel > 512) x->channel=512;
-	if (x->channel < 0) x->channel=0;
-	
-	if (!(x->dev_handle)) find_device(x);
-	else {
-		nBytes = usb_control_msg(x->dev_handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-									cmd_SetSingleChannel, n, x->channel, buffer, sizeof(buffer), 5000);
-		if(nBytes < 0)
-			 if (x->debug_flag) error("udmx: USB error: %s", usb_strerror());
-	}
+	val = n;
+	udmx_send(x, x->channel, 1, &val);
 }
 
 void udmx_ft1(t_udmx *x, t_floatarg f)
 {
-x->channel = f;
+	int n = f;
+
+	if (n > UDMX_CHANNELS - 1) n = UDMX_CHANNELS - 1;
+	if (n < 0) n = 0;
+	x->channel = n;
 }
 
 //--------------------------------------------------------------------------
 
-void udmx_list(t_udmx *x, t_symbol *s, short ac, t_atom *av)
+void udmx_list(t_udmx *x, t_symbol *s, int ac, t_atom *av)
 {
 	int i;
-	unsigned char* buf = malloc(ac);
-	int                 nBytes;
+	unsigned char buf[UDMX_CHANNELS];		// no allocation per message
 	int 		n;
 
-	if (x->channel > 512) x->channel=512;
-	if (x->channel < 0) x->channel=0;
+	if (x->port->debug_flag) post("udmx: ac: %i\n", ac);
+	if (ac > UDMX_CHANNELS - x->channel) ac = UDMX_CHANNELS - x->channel;
+	for(i=0; i<ac; ++i,av++) {
+		if (av->a_type==A_FLOAT) {
+			n = (int) av->a_w.w_float;
+			if (n > 255) n=255;
+			if (n < 0) n=0;
+
+			buf[i] = n;
+		} else
+			buf[i] = 0;
+	}
+	udmx_send(x, x->channel, ac, buf);
+}
 
-	if (!(x->dev_handle)) find_device(x);
-	else {
+//--------------------------------------------------------------------------
 
-		if (x->debug_flag) post("udmx: ac: %i\n", ac);
-		for(i=0; i<ac; ++i,av++) {
-			if (av->a_type==A_FLOAT) {
-				n = (int) av->a_w.w_float;
-				if (n > 255) n=255;
-				if (n < 0) n=0;
+void udmx_set(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// "set channel value channel value ...", all go out with one flush
+{
+	libudmx_span spans[64];
+	unsigned char values[64];
+	int nspans = 0, changed = 0, chan, n;
+
+	for (; ac >= 2; ac -= 2, av += 2) {
+		chan = atom_getfloatarg(0, ac, av);
+		if (chan < 0 || chan > UDMX_CHANNELS - 1) continue;
+		n = atom_getfloatarg(1, ac, av);
+		if (n > 255) n=255;
+		if (n < 0) n=0;
+		libudmx_ramp_stop(&x->port->ramps, chan, 1);	// a value set by hand ends the fade
+		values[nspans] = n;
+		spans[nspans].start = chan;
+		spans[nspans].len = 1;
+		spans[nspans].data = values + nspans;
+		if (++nspans == 64) {				// one call to libudmx per batch, not per channel
+			changed += libudmx_apply(x->port->dev, spans, nspans);
+			nspans = 0;
+		}
+	}
+	if (nspans) changed += libudmx_apply(x->port->dev, spans, nspans);
+	if (changed > 0) udmx_schedule(x->port);
+}
+
+//--------------------------------------------------------------------------
 
-				buf[i] = n;
-			} else
-				buf[i] = 0;
+void udmx_array(t_udmx *x, t_symbol *name, t_floatarg onset)	// "array name [onset]": the table from onset, 0..255, into the channels from ours
+{
+	unsigned char buf[UDMX_CHANNELS];
+	t_garray *a;
+	t_float *vec;
+	int size, i, n, from = onset;
+
+	if (!(a = (t_garray *)pd_findbyclass(name, garray_class)) || !garray_getfloatarray(a, &size, &vec)) {
+		pd_error(x, "udmx: no array %s", name->s_name);
+		return;
+	}
+	if (from < 0) from = 0;
+	n = size - from;
+	if (n > UDMX_CHANNELS - x->channel) n = UDMX_CHANNELS - x->channel;
+	for (i = 0; i < n; i++) {				// no branches, the compiler vectorizes it
+		t_float f = vec[from + i];
+		f = f < 0 ? 0 : f;
+		f = f > 255 ? 255 : f;
+		buf[i] = (unsigned char)f;
+	}
+	if (n > 0) udmx_send(x, x->channel, n, buf);	// one span, libudmx diffs it
+}
+
+//--------------------------------------------------------------------------
+
+void udmx_ramp(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// "ramp channel target ms" or "ramp channel count target ms"
+{
+	unsigned char targets[UDMX_CHANNELS];
+	int chan, count = 1, n;
+
+	if (ac < 3) return;
+	chan = atom_getfloatarg(0, ac, av);
+	if (ac > 3) count = atom_getfloatarg(1, ac, av);
+	if (chan < 0 || chan > UDMX_CHANNELS - 1 || count < 1) return;
+	if (count > UDMX_CHANNELS - chan) count = UDMX_CHANNELS - chan;
+	n = atom_getfloatarg(ac - 2, ac, av);
+	if (n > 255) n=255;
+	if (n < 0) n=0;
+	memset(targets, n, count);
+	udmx_ramp_start(x->port, chan, count, targets, atom_getfloatarg(ac - 1, ac, av));
+}
+
+void udmx_ramplist(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// "ramplist ms value value ...", from our channel on
+{
+	unsigned char targets[UDMX_CHANNELS];
+	int i, n;
+
+	if (ac < 2) return;
+	for (i = 1; i < ac && x->channel + i - 1 < UDMX_CHANNELS; i++) {
+		n = atom_getfloatarg(i, ac, av);
+		if (n > 255) n=255;
+		if (n < 0) n=0;
+		targets[i - 1] = n;
+	}
+	udmx_ramp_start(x->port, x->channel, i - 1, targets, atom_getfloatarg(0, ac, av));
+}
+
+void udmx_ramp_start(t_udmx_port *p, int from, int len, unsigned char *targets, double ms)
+{
+	libudmx_ramp(&p->ramps, libudmx_universe(p->dev), from, len, targets, ms, clock_gettimesince(p->epoch));
+	udmx_schedule(p);				// the clock does the rest
+}
+
+//--------------------------------------------------------------------------
+
+void udmx_send(t_udmx *x, int from, int len, unsigned char *values)
+{
+	libudmx_span span;
+
+	if (from > UDMX_CHANNELS - 1) from = UDMX_CHANNELS - 1;
+	if (from < 0) from = 0;
+	if (len > UDMX_CHANNELS - from) len = UDMX_CHANNELS - from;
+	libudmx_ramp_stop(&x->port->ramps, from, len);	// a value set by hand ends the fade
+	span.start = from;
+	span.len = len;
+	span.data = values;
+	if (libudmx_apply(x->port->dev, &span, 1) > 0)	// libudmx drops values that did not change
+		udmx_schedule(x->port);
+}
+
+//--------------------------------------------------------------------------
+// udmx_schedule
+//
+// 	-> set the clock for the next flush, if it isn't already: at the end of
+//	   this logical tick, or when the speed limit has passed
+
+void udmx_schedule(t_udmx_port *p)
+{
+	double since;
+
+	if (p->clock_set) return;
+	since = clock_gettimesince(p->flushed);
+	clock_delay(p->clock, since < p->interval ? p->interval - since : 0);
+	p->clock_set = 1;
+}
+
+//--------------------------------------------------------------------------
+// udmx_tick
+//
+// 	-> clock callback: flush the changes, look for the device if needed
+
+void udmx_tick(t_udmx_port *p)
+{
+	double interval;
+
+	p->clock_set = 0;
+	if (libudmx_ramps_active(&p->ramps)) {		// the values of the fades at this flush, one diff over the universe
+		unsigned char frame[UDMX_CHANNELS];
+		memcpy(frame, libudmx_universe(p->dev), UDMX_CHANNELS);
+		if (libudmx_ramps_step(&p->ramps, clock_gettimesince(p->epoch), frame, NULL))
+			libudmx_apply_frame(p->dev, frame);
+	}
+	if (!libudmx_is_connected(p->dev) || p->connecting) {
+		double since = clock_gettimesince(p->searched);
+		int looked = p->search || p->connecting || since >= RECONNECT_INTERVAL, found = 0;
+		if (looked) found = find_device(p);
+		if (found < 0) {						// not done yet, the scheduler goes on meanwhile
+			clock_delay(p->clock, CONNECT_POLL);
+			p->clock_set = 1;
+			return;
+		}
+		if (!found) {
+			if (libudmx_is_dirty(p->dev) || libudmx_ramps_active(&p->ramps)) {	// changes are kept until we find it
+				clock_delay(p->clock, looked ? RECONNECT_INTERVAL : RECONNECT_INTERVAL - since);
+				p->clock_set = 1;
+			}
+			p->search = 0;
+			return;
 		}
-		nBytes = usb_control_msg(x->dev_handle, USB_TYPE_VENDOR | USB_RECIP_DEVICE | USB_ENDPOINT_OUT,
-									cmd_SetChannelRange, ac, x->channel, buf, ac, 5000);
-		if (x->debug_flag) post( "bytes returned: %i\n", nBytes);
-		if(nBytes < 0)
-           if (x->debug_flag) error("udmx: USB error: %s\n", usb_strerror());
-		else if(nBytes > 0)  if (x->debug_flag) post("udmx: returned: %i\n", (int)(buf[0]));
-		free(buf);
 	}
+
+	if (libudmx_flush(p->dev) < 0) {
+		if (p->debug_flag) pd_error(0, "udmx: USB error: %s", libudmx_strerror(p->dev));
+		if (!libudmx_is_connected(p->dev)) p->search = 1;	// unplugged, look again right away
+	}
+
+	// changes meanwhile go out together after the pause, as in the Max object
+	if (p->speedlim_min < p->speedlim_max && libudmx_next_frame(p->dev, NULL) >= 0.)
+		interval = libudmx_next_flush(p->dev, p->speedlim_min);
+	else
+		interval = libudmx_interval(p->dev);
+	if (interval < p->speedlim_min) interval = p->speedlim_min;
+	if (interval > p->speedlim_max) interval = p->speedlim_max;
+	p->flushed = clock_getlogicaltime();
+	p->interval = interval;
+
+	if (libudmx_is_connected(p->dev)) {		// what udmx~ needs: a frame, or the speed limit
+		double frame = libudmx_interval(p->dev);
+		if (frame < p->speedlim_min) frame = p->speedlim_min;
+		if (frame > p->speedlim_max) frame = p->speedlim_max;
+		p->frame = frame > FRAME_MIN ? frame : FRAME_MIN;
+	}
+	if (libudmx_ramps_active(&p->ramps)) {		// fades go on by themselves, one step per frame
+		if (p->interval < p->frame) p->interval = p->frame;
+		udmx_schedule(p);
+	} else if (libudmx_is_dirty(p->dev)) udmx_schedule(p);
 }
 
 //--------------------------------------------------------------------------
 
-void udmx_debug(t_udmx *x, t_symbol *s, short ac, t_atom *av)	// x = the instance of the object; n = the int received in the left inlet 
+void udmx_debug(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// x = the instance of the object; n = the int received in the left inlet
 {
-	x->debug_flag = 1;
+	x->port->debug_flag = 1;
 	if (ac) {
-		if (av->a_type==A_FLOAT) x->debug_flag = av->a_w.w_float;
+		if (av->a_type==A_FLOAT) x->port->debug_flag = av->a_w.w_float;
 	}
 }
 
 
 
+//--------------------------------------------------------------------------
+
+void udmx_policy(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// deadline in ms, retries, backoff in ms
+{
+	libudmx_policy policy;
+
+	libudmx_get_policy(x->port->dev, &policy);
+	if (ac > 0) policy.deadline = atom_getfloatarg(0, ac, av);
+	if (ac > 1) policy.retries = atom_getfloatarg(1, ac, av);
+	if (ac > 2) policy.backoff = atom_getfloatarg(2, ac, av);
+	libudmx_set_policy(x->port->dev, &policy);
+}
+
+//--------------------------------------------------------------------------
+
+void udmx_speedlim(t_udmx *x, t_symbol *s, int ac, t_atom *av)	// "speedlim n" is fixed, "speedlim min max" adapts between the two, "speedlim auto" adapts to the link
+{
+	int lo, hi;
+
+	if (!ac || av->a_type != A_FLOAT) {
+		lo = 0;
+		hi = SPEED_LIMIT_MAX;
+	} else {
+		lo = hi = atom_getfloatarg(0, ac, av);
+		if (ac > 1) hi = atom_getfloatarg(1, ac, av);
+	}
+	if (lo < 0) lo = 0;
+	if (hi < lo) hi = lo;
+	if (hi > 65535) hi = 65535;
+	if (lo > hi) lo = hi;
+	x->port->speedlim_min = lo;
+	x->port->speedlim_max = hi;
+}
+
 //--------------------------------------------------------------------------
 
 void udmx_free(t_udmx *x)
 {
-	if (x->dev_handle)
-		usb_close(x->dev_handle);
+	udmx_port_release(x->port);
 }
 
 //--------------------------------------------------------------------------
 
 void udmx_open(t_udmx *x)
 {
-	if (x->dev_handle) {
+	t_udmx_port *p = x->port;
+
+	if (libudmx_is_connected(p->dev)) {
 		post("udmx: There is already a connection to www.anyma.ch/udmx",0);
-	} else find_device(x);
+	} else {
+		p->search = 1;				// the clock looks for it right away
+		clock_delay(p->clock, 0);
+		p->clock_set = 1;
+	}
 }
 
 //--------------------------------------------------------------------------
 
 void udmx_close(t_udmx *x)
 {
-	if (x->dev_handle) {
-		usb_close(x->dev_handle);
-		x->dev_handle = NULL;
+	t_udmx_port *p = x->port;
+	int open = libudmx_is_connected(p->dev) || p->connecting;
+
+	p->connecting = 0;
+	libudmx_disconnect(p->dev);			// an attempt that is still looking drops what it finds
+	if (open)
 		post("udmx: Closed connection to www.anyma.ch/udmx",0);
-	} else
+	else
 		post("udmx: There was no open connection to www.anyma.ch/udmx",0);
 }
 
 
 //--------------------------------------------------------------------------
 
-void *udmx_new(long n)		// n = int argument typed into object box (A_DEFLONG) -- defaults to 0 if no args are typed
+void *udmx_new(void)
 {
 	t_udmx *x;				// local variable (pointer to a t_udmx data structure)
+	t_udmx_port *p;
 
+	if (!(p = udmx_port_acquire(gensym("")))) return NULL;
 	x = (t_udmx *)pd_new(udmx_class); // create a new instance of this object
-	
+
 	// create a second int inlet (leftmost inlet is automatic - all objects have one inlet by default)
 	// floatinlet_new(x, x->channel); //crashes on PD .... assigns float in inlet 2 directly to channel
 	inlet_new(&x->p_ob, &x->p_ob.ob_pd, gensym("float"), gensym("ft1"));
 
 	x->channel = 0;
-	x->debug_flag = 0;
-	x->dev_handle = NULL;
-	
-	find_device(x);
+	x->port = p;
 
-	return(x);					// return a reference to the object instance 
+	return(x);					// return a reference to the object instance
 }
 
 //--------------------------------------------------------------------------
+// udmx_port_acquire
+//
+// 	-> the port of the device with this serial number, "" for the first one
+//	   found. the first object creates it, the clock then finds the device
 
+t_udmx_port *udmx_port_acquire(t_symbol *key)
+{
+	t_udmx_port *p;
 
-static int  usbGetStringAscii(usb_dev_handle *dev, int index, int langid, char *buf, int buflen)
+	for (p = ports; p; p = p->next) {
+		if (p->key == key) {
+			p->refcount++;
+			return p;
+		}
+	}
+	if (!(p = (t_udmx_port *)getbytes(sizeof(t_udmx_port)))) return NULL;
+	memset(p, 0, sizeof(t_udmx_port));
+	if (!(p->dev = libudmx_new(key->s_name))) {
+		freebytes(p, sizeof(t_udmx_port));
+		return NULL;
+	}
+	p->key = key;
+	p->refcount = 1;
+	p->clock = clock_new(p, (t_method)udmx_tick);
+	p->flushed = p->searched = p->epoch = clock_getlogicaltime();
+	p->search = 1;
+	p->frame = FRAME_DEFAULT;
+	p->speedlim_min = 0;
+	p->speedlim_max = SPEED_LIMIT_MAX;
+	libudmx_ramps_init(&p->ramps);
+	p->next = ports;
+	ports = p;
+
+	udmx_schedule(p);			// the clock finds the device, not while the patch loads
+	return p;
+}
+
+void udmx_port_release(t_udmx_port *p)
 {
-char    buffer[256];
-int     rval, i;
-
-    if((rval = usb_control_msg(dev, USB_ENDPOINT_IN, USB_REQ_GET_DESCRIPTOR, (USB_DT_STRING << 8) + index, langid, buffer, sizeof(buffer), 1000)) < 0)
-        return rval;
-    if(buffer[1] != USB_DT_STRING)
-        return 0;
-    if((unsigned char)buffer[0] < rval)
-        rval = (unsigned char)buffer[0];
-    rval /= 2;
-    /* lossy conversion to ISO Latin1 */
-    for(i=1;i<rval;i++){
-        if(i > buflen)  /* destination buffer overflow */
-            break;
-        buf[i-1] = buffer[2 * i];
-        if(buffer[2 * i + 1] != 0)  /* outside of ISO Latin1 range */
-            buf[i-1] = '?';
-    }
-    buf[i-1] = 0;
-    return i-1;
+	t_udmx_port **pp;
+
+	if (--p->refcount > 0) return;
+	for (pp = &ports; *pp; pp = &(*pp)->next) {
+		if (*pp == p) {
+			*pp = p->next;
+			break;
+		}
+	}
+	clock_free(p->clock);
+	libudmx_free(p->dev);
+	freebytes(p, sizeof(t_udmx_port));
 }
 
 //--------------------------------------------------------------------------
 
 
-void find_device(t_udmx *x)
+int find_device(t_udmx_port *p)		// returns 1 if connected, -1 while looking, only the clock calls it
 {
-	usb_dev_handle      *handle = NULL;
-	struct usb_bus      *bus;
-	struct usb_device   *dev;
-
- 	usb_init();
-	usb_find_busses();
-    usb_find_devices();
-	 for(bus=usb_get_busses(); bus; bus=bus->next){
-        for(dev=bus->devices; dev; dev=dev->next){
-            if(dev->descriptor.idVendor == USBDEV_SHARED_VENDOR && dev->descriptor.idProduct == USBDEV_SHARED_PRODUCT){
-                char    string[256];
-                int     len;
-                handle = usb_open(dev); /* we need to open the device in order to query strings */
-                if(!handle){
-                    error ("Warning: cannot open USB device: %s", usb_strerror());
-                    continue;
-                }
-                /* now find out whether the device actually is udmx */
-                len = usbGetStringAscii(handle, dev->descriptor.iManufacturer, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    post("udmx: warning: cannot query manufacturer for device: %s", usb_strerror());
-                    goto skipDevice;
-                }
-                
-			//	post("udmx: seen device from vendor ->%s<-", string); 
-                if(strcmp(string, "www.anyma.ch") != 0)
-                    goto skipDevice;
-                len = usbGetStringAscii(handle, dev->descriptor.iProduct, 0x0409, string, sizeof(string));
-                if(len < 0){
-                    post("udmx: warning: cannot query product for device: %s", usb_strerror());
-                    goto skipDevice;
-                }
-              //  post("udmx: seen product ->%s<-", string);
-                if(strcmp(string, "udmx") == 0)
-                    break;
-skipDevice:
-                usb_close(handle);
-                handle = NULL;
-            }
-        }
-        if(handle)
-            break;
-    }
-	
-    if(!handle){
-        post("udmx: Could not find USB device www.anyma.ch/udmx");
-		x->dev_handle = NULL;
-	} else {
-		x->dev_handle = handle;
-		 post("udmx: Found USB device www.anyma.ch/udmx");
+	int rval = libudmx_connect_async(p->dev);
+
+	p->connecting = rval == UDMX_PENDING;
+	if (p->connecting) return -1;
+	p->searched = clock_getlogicaltime();
+	p->search = 0;
+	if (rval == UDMX_BUS_UNCHANGED) return 0;	// nothing was plugged in since we last looked
+
+	if (rval != UDMX_OK) {
+		post("udmx: Could not find USB device www.anyma.ch/udmx");
+		return 0;
+	}
+	post("udmx: Found USB device www.anyma.ch/udmx");
+	return 1;					// the clock sends what was set while we were not connected
+}
+
+//--------------------------------------------------------------------------
+// udmx~
+
+void *udmx_tilde_new(t_symbol *s, int ac, t_atom *av)	// [udmx~ channels start serial], start counts from 0 like the right inlet of [udmx]
+{
+	t_udmx_tilde *x;
+	t_udmx_port *p;
+	t_symbol *serial = gensym("");
+	int channels = 1, start = 0, numbers = 0, i;
+
+	for (i = 0; i < ac; i++) {
+		if (av[i].a_type == A_SYMBOL) serial = atom_getsymbolarg(i, ac, av);
+		else if (numbers++ == 0) channels = atom_getfloatarg(i, ac, av);
+		else start = atom_getfloatarg(i, ac, av);
+	}
+	if (start < 0) start = 0;
+	if (start > UDMX_CHANNELS - 1) start = UDMX_CHANNELS - 1;
+	if (channels < 1) channels = 1;
+	if (channels > UDMX_CHANNELS - start) channels = UDMX_CHANNELS - start;
+
+	if (!(p = udmx_port_acquire(serial))) return NULL;
+	x = (t_udmx_tilde *)pd_new(udmx_tilde_class);
+	for (i = 1; i < channels; i++)			// the first one is the main signal inlet
+		inlet_new(&x->p_ob, &x->p_ob.ob_pd, &s_signal, &s_signal);
+	x->port = p;
+	x->start = start;
+	x->channels = channels;
+	x->ins = (t_sample **)getbytes(channels * sizeof(t_sample *));
+	x->samplerate = sys_getsr();
+	x->countdown = 0;
+	x->f = 0;
+	return x;
+}
+
+void udmx_tilde_free(t_udmx_tilde *x)
+{
+	freebytes(x->ins, x->channels * sizeof(t_sample *));
+	udmx_port_release(x->port);
+}
+
+void udmx_tilde_dsp(t_udmx_tilde *x, t_signal **sp)
+{
+	int i;
+
+	for (i = 0; i < x->channels; i++) x->ins[i] = sp[i]->s_vec;
+	x->samplerate = sp[0]->s_sr;
+	x->countdown = 0;
+	dsp_add(udmx_tilde_perform, 2, x, sp[0]->s_n);
+}
+
+//--------------------------------------------------------------------------
+// udmx_tilde_perform
+//
+// 	-> take the value of every inlet at the start of each DMX frame that
+//	   falls into this vector, the changes go out with the next flush
+
+t_int *udmx_tilde_perform(t_int *w)
+{
+	t_udmx_tilde *x = (t_udmx_tilde *)(w[1]);
+	int n = (int)(w[2]);
+	t_udmx_port *p = x->port;
+	unsigned char values[UDMX_CHANNELS];
+	libudmx_span span;
+	double at = x->countdown, period;
+	int c, changed = 0;
+
+	if (at >= n) {							// nothing due in this vector
+		x->countdown = at - n;
+		return (w+3);
+	}
+	period = x->samplerate * p->frame / 1000.;
+	libudmx_ramp_stop(&p->ramps, x->start, x->channels);	// the signal wins over fades on its channels
+	for (; at < n; at += period) {
+		int i = (int)at;
+		for (c = 0; c < x->channels; c++) {
+			t_sample f = x->ins[c][i] * 255.f;
+			f = f < 0 ? 0 : f;
+			f = f > 255 ? 255 : f;
+			values[c] = (unsigned char)f;
+		}
+		span.start = x->start;
+		span.len = x->channels;
+		span.data = values;
+		changed += libudmx_apply(p->dev, &span, 1);	// only what changed, libudmx diffs it
 	}
+	x->countdown = at - n;
+	if (changed > 0) udmx_schedule(p);		// Pd runs DSP and clocks in one thread
+	return (w+3);
 }
@@ -5,7 +5,7 @@ read -p "FLASHING BOOTLOADER: put gnusbAsp in high speed mode"
 # change to hi speed
 make flash
 cd ../firmware
-#change serial number
-bbedit main.c
-read -p "FLASHING FIRMWARE: please update serial number first"
-make flash
\ No newline at end of file
+make main.hex
+# the serial number is patched into main.hex by uboot, no need to edit main.c
+read -p "FLASHING FIRMWARE: unplug gnusbAsp, plug in all new units, then enter the first serial number: " serial
+../commandline/uboot -s "$serial" main.hex